@@ -3,9 +3,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "lc3101.h"
 #define MAXLINELENGTH 1000
-#define MAXNUMLABELS 65536
 #define MAXLABELLENGTH 7 /* includes the null character termination */
+#define MAXLINES 65536
+#define MAXBLOCK 64 /* longest run of instructions scheduled together */
 
 #define ADD 0
 #define NAND 1
@@ -17,36 +21,42 @@
 #define NOOP 7
 
 /*
- * Read and parse a line of the assembly-language file.  Fields are returned
- * in label, opcode, arg0, arg1, arg2 (these strings must have memory already
- * allocated to them).
+ * Read and parse the next line of the source buffer, advancing *srcPtr
+ * past it.  Fields are returned in label, opcode, arg0, arg1, arg2 (these
+ * strings must have memory already allocated to them).
  *
  * Return values:
- *     0 if reached end of file
+ *     0 if reached end of buffer
  *     1 if all went well
- *
- * exit(1) if line is too long.
+ *    -1 if line is too long
  */
 int
-readAndParse(FILE *inFilePtr, char *label, char *opcode, char *arg0,
-    char *arg1, char *arg2)
+readAndParse(const char **srcPtr, const char *end, char *label, char *opcode,
+    char *arg0, char *arg1, char *arg2)
 {
     char line[MAXLINELENGTH];
     char *ptr = line;
+    const char *src = *srcPtr;
+    int n;
 
     /* delete prior values */
     label[0] = opcode[0] = arg0[0] = arg1[0] = arg2[0] = '\0';
 
-    /* read the line from the assembly-language file */
-    if (fgets(line, MAXLINELENGTH, inFilePtr) == NULL) {
-	/* reached end of file */
+    /* read the line from the buffer, as fgets would */
+    if (src >= end) {
+	/* reached end of buffer */
         return(0);
     }
+    for (n = 0; n < MAXLINELENGTH-1 && src < end && (n == 0 || line[n-1] != '\n');
+	    n++) {
+	line[n] = *src++;
+    }
+    line[n] = '\0';
+    *srcPtr = src;
 
     /* check for line too long */
     if (strlen(line) == MAXLINELENGTH-1) {
-	printf("error: line too long\n");
-	exit(1);
+	return(-1);
     }
 
     /* is there a label? */
@@ -65,9 +75,10 @@ readAndParse(FILE *inFilePtr, char *label, char *opcode, char *arg0,
     return(1);
 }
 
+/* returns the label's address, or -1 if it is not defined */
 int
-translateSymbol(char labelArray[MAXNUMLABELS][MAXLABELLENGTH],
-    int labelAddress[MAXNUMLABELS], int numLabels, char *symbol)
+translateSymbol(char labelArray[][MAXLABELLENGTH], int labelAddress[],
+    int numLabels, char *symbol)
 {
     int i;
 
@@ -76,8 +87,7 @@ translateSymbol(char labelArray[MAXNUMLABELS][MAXLABELLENGTH],
     }
 
     if (i>=numLabels) {
-	printf("error: missing label %s\n", symbol);
-	exit(1);
+	return(-1);
     }
 
     return(labelAddress[i]);
@@ -91,30 +101,41 @@ isNumber(char *string)
     return( (sscanf(string, "%d", &i)) == 1);
 }
 
+/* record an error message in the image and return status */
+int
+fail(imageType *image, int status, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(image->error, LC_MAXERROR, format, args);
+    va_end(args);
+    return(status);
+}
+
 /*
  * Test register argument; make sure it's in range and has no bad characters.
  */
-void
-testRegArg(char *arg)
+int
+testRegArg(char *arg, imageType *image)
 {
     int num;
     char c;
 
     if (atoi(arg) < 0 || atoi(arg) > 7) {
-	printf("error: register out of range\n");
-	exit(2);
+	return(fail(image, LC_BADARG, "error: register out of range"));
     }
     if (sscanf(arg, "%d%c", &num, &c) != 1) {
-	printf("bad character in register argument\n");
-	exit(2);
+	return(fail(image, LC_BADARG, "bad character in register argument"));
     }
+    return(LC_OK);
 }
 
 /*
  * Test addressField argument.
  */
-void
-testAddrArg(char *arg)
+int
+testAddrArg(char *arg, imageType *image)
 {
     int num;
     char c;
@@ -122,60 +143,330 @@ testAddrArg(char *arg)
     /* test numeric addressField */
     if (isNumber(arg)) {
 	if (sscanf(arg, "%d%c", &num, &c) != 1) {
-	    printf("bad character in addressField\n");
-	    exit(2);
+	    return(fail(image, LC_BADARG, "bad character in addressField"));
 	}
     }
+    return(LC_OK);
 }
 
 /*
- * main function
+ * Scheduling pass (-O).  The program is split into basic blocks (a label
+ * starts one; beq, jalr and halt end one; .fill lines are never moved).
+ * Within a block instructions are list-scheduled in dependency order,
+ * preferring loads early and never placing a reader directly behind the
+ * lw it depends on, which is the pipeline's only stall besides a taken
+ * branch.  A block whose new order is no cheaper keeps its old one.  A
+ * program is only scheduled when every lw and sw reaches a known data
+ * word, and its noops are dropped only when no address field is numeric,
+ * since removing them moves every later address.  The result replaces the
+ * parsed lines before they are encoded.
  */
+typedef struct lineStruct {
+    char *label;
+    char *opcode;
+    char *arg0;
+    char *arg1;
+    char *arg2;
+    int line; /* line in the original source */
+} lineType;
+
 int
-main(int argc, char *argv[])
+isInstruction(lineType *l)
 {
-    char *inFileString, *outFileString;
-    FILE *inFilePtr, *outFilePtr;
-    int address;
-    char label[MAXLINELENGTH], opcode[MAXLINELENGTH], arg0[MAXLINELENGTH],
-	arg1[MAXLINELENGTH], arg2[MAXLINELENGTH], argTmp[MAXLINELENGTH];
-    int i;
-    int numLabels=0;
-    int num;
-    int addressField;
+    return(strcmp(l->opcode, ".fill"));
+}
 
-    char labelArray[MAXNUMLABELS][MAXLABELLENGTH];
-    int labelAddress[MAXNUMLABELS];
+int
+isTerminator(lineType *l)
+{
+    return(!strcmp(l->opcode, "beq") || !strcmp(l->opcode, "jalr") ||
+	!strcmp(l->opcode, "halt"));
+}
 
-    if (argc != 3) {
-	printf("error: usage: %s <assembly-code-file> <machine-code-file>\n",
-	    argv[0]);
-	exit(1);
+/*
+ * registers read and written by an instruction; returns the number read
+ * (into regs) and sets *dest to the register written or -1
+ */
+int
+regUse(lineType *l, int regs[2], int *dest)
+{
+    *dest = -1;
+    if (!strcmp(l->opcode, "add") || !strcmp(l->opcode, "nand")) {
+	regs[0] = atoi(l->arg0);
+	regs[1] = atoi(l->arg1);
+	*dest = atoi(l->arg2);
+	return(2);
+    }
+    if (!strcmp(l->opcode, "lw") || !strcmp(l->opcode, "jalr")) {
+	regs[0] = atoi(l->arg0);
+	*dest = atoi(l->arg1);
+	return(1);
     }
+    if (!strcmp(l->opcode, "sw") || !strcmp(l->opcode, "beq")) {
+	regs[0] = atoi(l->arg0);
+	regs[1] = atoi(l->arg1);
+	return(2);
+    }
+    return(0);
+}
 
-    inFileString = argv[1];
-    outFileString = argv[2];
+/*
+ * would next stall behind prev?  This is the simulator's stallHazard rule:
+ * an lw followed by anything whose regA or regB field names its regB.
+ */
+int
+causesStall(lineType *prev, lineType *next)
+{
+    int dest;
 
-    inFilePtr = fopen(inFileString, "r");
-    if (inFilePtr == NULL) {
-	printf("error in opening %s\n", inFileString);
-	exit(1);
+    if (prev == NULL || strcmp(prev->opcode, "lw") || !isInstruction(next)) {
+	return(0);
     }
-    outFilePtr = fopen(outFileString, "w");
-    if (outFilePtr == NULL) {
-	printf("error in opening %s\n", outFileString);
-	exit(1);
+    dest = atoi(prev->arg1);
+    return(atoi(next->arg0) == dest || atoi(next->arg1) == dest);
+}
+
+/* must b (later in program order) stay after a? */
+int
+dependsOn(lineType *a, lineType *b)
+{
+    int readA[2], readB[2], destA, destB, numA, numB, i;
+    int memA, memB;
+
+    numA = regUse(a, readA, &destA);
+    numB = regUse(b, readB, &destB);
+
+    for (i = 0; i < numB; i++) {
+	if (readB[i] == destA) {
+	    return(1); /* read after write */
+	}
+    }
+    for (i = 0; i < numA; i++) {
+	if (readA[i] == destB) {
+	    return(1); /* write after read */
+	}
+    }
+    if (destA >= 0 && destA == destB) {
+	return(1); /* write after write */
     }
 
-    /* map symbols to addresses */
+    /* a store is ordered against every other memory access */
+    memA = !strcmp(a->opcode, "lw") || !strcmp(a->opcode, "sw");
+    memB = !strcmp(b->opcode, "lw") || !strcmp(b->opcode, "sw");
+    return(memA && memB &&
+	(!strcmp(a->opcode, "sw") || !strcmp(b->opcode, "sw")));
+}
 
-    /* assume address start at 0 */
-    for (address=0; readAndParse(inFilePtr, label, opcode, arg0, arg1, arg2);
-	    address++) {
-	/*
-	printf("%d: label=%s, opcode=%s, arg0=%s, arg1=%s, arg2=%s\n",
-	    address, label, opcode, arg0, arg1, arg2);
-	*/
+int
+countStalls(lineType *prog, int n)
+{
+    int i, stalls = 0;
+
+    for (i = 1; i < n; i++) {
+	if (isInstruction(&prog[i-1])) {
+	    stalls += causesStall(&prog[i-1], &prog[i]);
+	}
+    }
+    return(stalls);
+}
+
+/*
+ * schedule block[0..n) onto out[m..]; the line already at out[m-1] is taken
+ * into account.  Returns the new end of out.
+ */
+int
+scheduleBlock(lineType *block, int n, lineType *out, int m, int removeNoops)
+{
+    int dep[MAXBLOCK][MAXBLOCK], done[MAXBLOCK];
+    int numNodes, i, j, k, pick, pickRank, rank, ready, first;
+    lineType *prev, *terminator;
+    char *label = block[0].label;
+
+    terminator = isTerminator(&block[n-1]) ? &block[n-1] : NULL;
+    numNodes = terminator ? n-1 : n;
+
+    for (i = 0; i < numNodes; i++) {
+	done[i] = removeNoops && !strcmp(block[i].opcode, "noop");
+	for (j = 0; j < i; j++) {
+	    dep[i][j] = dependsOn(&block[j], &block[i]);
+	}
+    }
+    /* a label needs something to sit on */
+    if (!terminator && label[0] != '\0') {
+	for (i = 0; i < numNodes && done[i]; i++) {
+	}
+	if (i == numNodes) {
+	    done[0] = 0;
+	}
+    }
+
+    first = m;
+    while (1) {
+	prev = (m > 0 && isInstruction(&out[m-1])) ? &out[m-1] : NULL;
+	pick = -1;
+	pickRank = 4;
+	for (k = 0; k < numNodes; k++) {
+	    if (done[k]) {
+		continue;
+	    }
+	    for (ready = 1, j = 0; j < k && ready; j++) {
+		ready = done[j] || !dep[k][j];
+	    }
+	    if (!ready) {
+		continue;
+	    }
+	    /* rank 0: lw, 1: other, 2: noop, 3: anything that stalls */
+	    if (causesStall(prev, &block[k])) {
+		rank = 3;
+	    } else if (!strcmp(block[k].opcode, "lw")) {
+		rank = 0;
+	    } else if (!strcmp(block[k].opcode, "noop")) {
+		rank = 2;
+	    } else {
+		rank = 1;
+	    }
+	    if (rank < pickRank) {
+		pick = k;
+		pickRank = rank;
+	    }
+	}
+	if (pick < 0) {
+	    break;
+	}
+	done[pick] = 1;
+	out[m] = block[pick];
+	out[m++].label = "";
+    }
+    if (terminator) {
+	out[m] = *terminator;
+	out[m++].label = "";
+    }
+    if (m > first) {
+	out[first].label = label;
+    }
+    return(m);
+}
+
+/*
+ * schedule the (already validated) program prog[0..n) into out and return
+ * its new length; every line keeps its original source line number.  What
+ * was changed is described on report.
+ */
+int
+scheduleProgram(lineType *prog, int n, lineType *out, FILE *report)
+{
+    int m, i, j, start, end, removeNoops, stallsBefore, stallsAfter;
+    int blockStalls, blockWords, regs[2], dest;
+    char *why = NULL;
+
+    /*
+     * every lw and sw must reach a known data word: from register 0, which
+     * nothing writes, through a label or number that is not code.  Anything
+     * else may read code that is about to move, so the program is left
+     * alone.  Numeric address fields pin the layout, so noops stay.
+     */
+    removeNoops = 1;
+    for (i = 0; i < n; i++) {
+	if (!isInstruction(&prog[i])) {
+	    continue;
+	}
+	regUse(&prog[i], regs, &dest);
+	if (dest == 0) {
+	    why = "writes register 0";
+	    break;
+	}
+	if (!strcmp(prog[i].opcode, "beq") && isNumber(prog[i].arg2)) {
+	    removeNoops = 0;
+	}
+	if (strcmp(prog[i].opcode, "lw") && strcmp(prog[i].opcode, "sw")) {
+	    continue;
+	}
+	if (atoi(prog[i].arg0) != 0) {
+	    why = "has a computed address";
+	    break;
+	}
+	if (isNumber(prog[i].arg2)) {
+	    removeNoops = 0;
+	    j = atoi(prog[i].arg2);
+	} else {
+	    for (j = 0; j < n && strcmp(prog[j].label, prog[i].arg2); j++) {
+	    }
+	}
+	if (j >= 0 && j < n && isInstruction(&prog[j])) {
+	    why = "accesses code";
+	    break;
+	}
+    }
+    if (why != NULL) {
+	fprintf(report, "schedule: %s at address %d %s; not scheduled\n",
+	    prog[i].opcode, i, why);
+	memcpy(out, prog, n * sizeof(lineType));
+	return(n);
+    }
+    if (!removeNoops) {
+	fprintf(report, "schedule: numeric address fields, keeping noops\n");
+    }
+
+    for (m = 0, start = 0; start < n; start = end) {
+	if (!isInstruction(&prog[start])) {
+	    out[m++] = prog[start];
+	    end = start+1;
+	    continue;
+	}
+	for (end = start+1; end < n && end - start < MAXBLOCK &&
+		isInstruction(&prog[end]) && prog[end].label[0] == '\0' &&
+		!isTerminator(&prog[end-1]); end++) {
+	}
+
+	blockStalls = countStalls(prog + start, end - start) +
+	    (m > 0 && isInstruction(&out[m-1]) &&
+	     causesStall(&out[m-1], &prog[start]));
+	blockWords = m;
+	m = scheduleBlock(prog + start, end - start, out, m, removeNoops);
+	blockWords = m - blockWords;
+	stallsAfter = countStalls(out + m - blockWords, blockWords) +
+	    (m > blockWords && isInstruction(&out[m-blockWords-1]) &&
+	     causesStall(&out[m-blockWords-1], &out[m-blockWords]));
+	/* an order that costs no less than the original is not kept */
+	if (stallsAfter + blockWords >= blockStalls + end - start) {
+	    m -= blockWords;
+	    memcpy(out + m, prog + start, (end - start) * sizeof(lineType));
+	    m += end - start;
+	    continue;
+	}
+	if (blockStalls != stallsAfter || blockWords != end - start) {
+	    fprintf(report, "schedule: block at line %d%s%s: %d -> %d words, "
+		"%d -> %d load-use stalls\n", prog[start].line,
+		prog[start].label[0] ? " " : "", prog[start].label,
+		end - start, blockWords, blockStalls, stallsAfter);
+	}
+    }
+
+    stallsBefore = countStalls(prog, n);
+    stallsAfter = countStalls(out, m);
+    fprintf(report, "schedule: %d noops removed, load-use stalls %d -> %d\n",
+	n - m, stallsBefore, stallsAfter);
+    fprintf(report, "schedule: expect %d fewer cycles per pass through the code\n",
+	(n - m) + stallsBefore - stallsAfter);
+    return(m);
+}
+
+/*
+ * first pass: check every line; returns LC_OK or the error status
+ */
+int
+checkLines(lineType *prog, int n, imageType *image)
+{
+    char argTmp[MAXLINELENGTH];
+    char *label, *opcode, *arg0, *arg1, *arg2;
+    int address, i, status;
+
+    for (address=0; address<n; address++) {
+	label = prog[address].label;
+	opcode = prog[address].opcode;
+	arg0 = prog[address].arg0;
+	arg1 = prog[address].arg1;
+	arg2 = prog[address].arg2;
 
 	/* check for illegal opcode */
 	if (strcmp(opcode, "add") && strcmp(opcode, "nand") &&
@@ -183,29 +474,37 @@ main(int argc, char *argv[])
 		strcmp(opcode, "beq") && strcmp(opcode, "jalr") &&
 		strcmp(opcode, "halt") && strcmp(opcode, "noop") &&
 		strcmp(opcode, ".fill") ) {
-	    printf("error: unrecognized opcode %s at address %d\n", opcode,
-		    address);
-	    exit(1);
+	    return(fail(image, LC_ERROR,
+		"error: unrecognized opcode %s at address %d", opcode,
+		address));
 	}
 
 	/* check register fields */
 	if (!strcmp(opcode, "add") || !strcmp(opcode, "nand") ||
 		!strcmp(opcode, "lw") || !strcmp(opcode, "sw") ||
 		!strcmp(opcode, "beq") || !strcmp(opcode, "jalr")) {
-	    testRegArg(arg0);
-	    testRegArg(arg1);
+	    if ((status = testRegArg(arg0, image)) != LC_OK ||
+		    (status = testRegArg(arg1, image)) != LC_OK) {
+		return(status);
+	    }
 	}
 	if (!strcmp(opcode, "add") || !strcmp(opcode, "nand")) {
-	    testRegArg(arg2);
+	    if ((status = testRegArg(arg2, image)) != LC_OK) {
+		return(status);
+	    }
 	}
 
 	/* check addressField */
 	if (!strcmp(opcode, "lw") || !strcmp(opcode, "sw") ||
 		!strcmp(opcode, "beq")) {
-	    testAddrArg(arg2);
+	    if ((status = testAddrArg(arg2, image)) != LC_OK) {
+		return(status);
+	    }
 	}
 	if (!strcmp(opcode, ".fill")) {
-	    testAddrArg(arg0);
+	    if ((status = testAddrArg(arg0, image)) != LC_OK) {
+		return(status);
+	    }
 	}
 
 	/* check for enough arguments */
@@ -214,58 +513,67 @@ main(int argc, char *argv[])
 	      && arg2[0]=='\0') ||
 	     (!strcmp(opcode, "jalr") && arg1[0]=='\0') ||
 	     (!strcmp(opcode, ".fill") && arg0[0]=='\0')) {
-	    printf("error at address %d: not enough arguments\n", address);
-	    exit(2);
+	    return(fail(image, LC_BADARG,
+		"error at address %d: not enough arguments", address));
 	}
 
 	if (label[0] != '\0') {
 	    /* check for labels that are too long */
 	    if (strlen(label) >= MAXLABELLENGTH) {
-		printf("label too long\n");
-		exit(2);
+		return(fail(image, LC_BADARG, "label too long"));
 	    }
 
 	    /* make sure label starts with letter */
 	    if (! sscanf(label, "%[a-zA-Z]", argTmp) ) {
-	        printf("label doesn't start with letter\n");
-		exit(2);
+		return(fail(image, LC_BADARG, "label doesn't start with letter"));
 	    }
 
 	    /* make sure label consists of only letters and numbers */
 	    sscanf(label, "%[a-zA-Z0-9]", argTmp);
 	    if (strcmp(argTmp, label)) {
-	        printf("label has character other than letters and numbers\n");
-		exit(2);
+		return(fail(image, LC_BADARG,
+		    "label has character other than letters and numbers"));
 	    }
 
 	    /* look for duplicate label */
-	    for (i=0; i<numLabels; i++) {
-		if (!strcmp(label, labelArray[i])) {
-		    printf("error: duplicate label %s at address %d\n",
-			label, address);
-		    exit(1);
+	    for (i=0; i<address; i++) {
+		if (!strcmp(label, prog[i].label)) {
+		    return(fail(image, LC_ERROR,
+			"error: duplicate label %s at address %d", label,
+			address));
 		}
 	    }
-	    /* see if there are too many labels */
-	    if (numLabels >= MAXNUMLABELS) {
-		printf("error: too many labels (label=%s)\n", label);
-		exit(2);
-	    }
-
-	    strcpy(labelArray[numLabels], label);
-	    labelAddress[numLabels++] = address;
 	}
     }
+    return(LC_OK);
+}
 
-    for (i=0; i<numLabels; i++) {
-	/* printf("%s = %d\n", labelArray[i], labelAddress[i]); */
+/* encode prog[0..n) into image using the given symbol table */
+int
+encodeWords(lineType *prog, int n, int flags, imageType *image,
+    char labelArray[][MAXLABELLENGTH], int labelAddress[], int numLabels)
+{
+    char text[5 * MAXLINELENGTH];
+    char *opcode, *arg0, *arg1, *arg2;
+    int address, num, addressField;
+
+    image->numWords = n;
+    image->words = malloc(n * sizeof(int));
+    image->line = malloc(n * sizeof(int));
+    if (flags & LC_SOURCE) {
+	image->source = calloc(n, sizeof(char *));
     }
+    if (image->words == NULL || image->line == NULL ||
+	    ((flags & LC_SOURCE) && image->source == NULL)) {
+	return(fail(image, LC_ERROR, "error: out of memory"));
+    }
+
+    for (address=0; address<n; address++) {
+	opcode = prog[address].opcode;
+	arg0 = prog[address].arg0;
+	arg1 = prog[address].arg1;
+	arg2 = prog[address].arg2;
 
-    /* now do second pass (print machine code, with symbols filled in as
-	addresses) */
-    rewind(inFilePtr);
-    for (address=0; readAndParse(inFilePtr, label, opcode, arg0, arg1, arg2);
-	    address++) {
 	if (!strcmp(opcode, "add")) {
 	    num = (ADD << 22) | (atoi(arg0) << 19) | (atoi(arg1) << 16)
 		    | atoi(arg2);
@@ -284,9 +592,10 @@ main(int argc, char *argv[])
 	    if (!isNumber(arg2)) {
 		addressField = translateSymbol(labelArray, labelAddress,
 					    numLabels, arg2);
-		/*
-		printf("%s being translated into %d\n", arg2, addressField);
-		*/
+		if (addressField < 0) {
+		    return(fail(image, LC_ERROR, "error: missing label %s",
+			arg2));
+		}
 		if (!strcmp(opcode, "beq")) {
 		    addressField = addressField-address-1;
 		}
@@ -296,8 +605,8 @@ main(int argc, char *argv[])
 
 
 	    if (addressField < -32768 || addressField > 32767) {
-		printf("error: offset %d out of range\n", addressField);
-		exit(1);
+		return(fail(image, LC_ERROR, "error: offset %d out of range",
+		    addressField));
 	    }
 
 	    /* truncate the offset field, in case it's negative */
@@ -316,18 +625,284 @@ main(int argc, char *argv[])
 			    (atoi(arg1) << 16) | addressField;
 		}
 	    }
-	} else if (!strcmp(opcode, ".fill")) {
+	} else {
+	    /* .fill */
 	    if (!isNumber(arg0)) {
 		num = translateSymbol(labelArray, labelAddress, numLabels,
 					arg0);
+		if (num < 0) {
+		    return(fail(image, LC_ERROR, "error: missing label %s",
+			arg0));
+		}
 	    } else {
 		num = atoi(arg0);
 	    }
 	}
-	/* printf("(address %d): %d (hex 0x%x)\n", address, num, num); */
-	fprintf(outFilePtr, "%d\n", num);
+	image->words[address] = num;
+	image->line[address] = prog[address].line;
+
+	/* the source is re-emitted with single spaces */
+	if (flags & LC_SOURCE) {
+	    snprintf(text, sizeof(text), "%s %s%s%s%s%s%s%s",
+		prog[address].label[0] != '\0' ? prog[address].label : "-",
+		opcode, arg0[0] ? " " : "", arg0, arg1[0] ? " " : "", arg1,
+		arg2[0] ? " " : "", arg2);
+	    image->source[address] = strdup(text);
+	    if (image->source[address] == NULL) {
+		return(fail(image, LC_ERROR, "error: out of memory"));
+	    }
+	}
     }
+    return(LC_OK);
+}
 
-    exit(0);
+/*
+ * second pass: encode prog[0..n) into image, with symbols filled in as
+ * addresses.  The symbol table is on the heap, since library callers may
+ * run on threads with small stacks.
+ */
+int
+encodeLines(lineType *prog, int n, int flags, imageType *image)
+{
+    char (*labelArray)[MAXLABELLENGTH];
+    int *labelAddress;
+    int address, numLabels, status;
+
+    labelArray = malloc((n + 1) * sizeof(*labelArray));
+    labelAddress = malloc((n + 1) * sizeof(int));
+    if (labelArray == NULL || labelAddress == NULL) {
+	free(labelArray);
+	free(labelAddress);
+	return(fail(image, LC_ERROR, "error: out of memory"));
+    }
+
+    /* map symbols to addresses */
+    for (address=0, numLabels=0; address<n; address++) {
+	if (prog[address].label[0] != '\0') {
+	    strcpy(labelArray[numLabels], prog[address].label);
+	    labelAddress[numLabels++] = address;
+	}
+    }
+
+    status = encodeWords(prog, n, flags, image, labelArray, labelAddress,
+	numLabels);
+    free(labelArray);
+    free(labelAddress);
+    return(status);
+}
+
+
+/*
+ * Assemble length bytes of source into image.  The source is parsed once
+ * into lines, which are checked, optionally rescheduled and encoded one
+ * word per line.  Returns LC_OK, or an error status with the message in
+ * image->error.
+ */
+int
+assemble(const char *source, size_t length, int flags, imageType *image)
+{
+    char label[MAXLINELENGTH], opcode[MAXLINELENGTH], arg0[MAXLINELENGTH],
+	arg1[MAXLINELENGTH], arg2[MAXLINELENGTH];
+    const char *src = source;
+    char *fields, *next;
+    lineType *prog, *out = NULL;
+    FILE *report;
+    size_t i, reportLength;
+    int n, maxLines, status;
+
+    memset(image, 0, sizeof(imageType));
+
+    /* every field of a line is a piece of it, so fields fit in the source */
+    for (maxLines = 1, i = 0; i < length; i++) {
+	maxLines += source[i] == '\n';
+    }
+    prog = malloc(maxLines * sizeof(lineType));
+    fields = malloc(length + 5 * maxLines);
+    if (flags & LC_OPTIMIZE) {
+	out = malloc(maxLines * sizeof(lineType));
+    }
+    if (prog == NULL || fields == NULL || ((flags & LC_OPTIMIZE) && out == NULL)) {
+	status = fail(image, LC_ERROR, "error: out of memory");
+	goto done;
+    }
+
+    next = fields;
+    for (n = 0; (status = readAndParse(&src, source + length, label, opcode,
+	    arg0, arg1, arg2)) != 0; n++) {
+	if (status < 0) {
+	    status = fail(image, LC_ERROR, "error: line too long");
+	    goto done;
+	}
+	if (n >= MAXLINES) {
+	    status = fail(image, LC_ERROR, "error: more than %d words",
+		MAXLINES);
+	    goto done;
+	}
+	prog[n].label = strcpy(next, label);
+	next += strlen(label) + 1;
+	prog[n].opcode = strcpy(next, opcode);
+	next += strlen(opcode) + 1;
+	prog[n].arg0 = strcpy(next, arg0);
+	next += strlen(arg0) + 1;
+	prog[n].arg1 = strcpy(next, arg1);
+	next += strlen(arg1) + 1;
+	prog[n].arg2 = strcpy(next, arg2);
+	next += strlen(arg2) + 1;
+	prog[n].line = n+1;
+    }
+
+    status = checkLines(prog, n, image);
+    if (status == LC_OK && (flags & LC_OPTIMIZE)) {
+	report = open_memstream(&image->report, &reportLength);
+	if (report == NULL) {
+	    status = fail(image, LC_ERROR, "error: out of memory");
+	    goto done;
+	}
+	n = scheduleProgram(prog, n, out, report);
+	fclose(report);
+	status = encodeLines(out, n, flags, image);
+    } else if (status == LC_OK) {
+	status = encodeLines(prog, n, flags, image);
+    }
+
+done:
+    free(prog);
+    free(out);
+    free(fields);
+    if (status != LC_OK) {
+	freeImage(image);
+    }
+    return(status);
+}
+
+void
+freeImage(imageType *image)
+{
+    int i;
+
+    if (image->source != NULL) {
+	for (i = 0; i < image->numWords; i++) {
+	    free(image->source[i]);
+	}
+    }
+    free(image->source);
+    free(image->words);
+    free(image->line);
+    free(image->report);
+    image->report = NULL;
+    image->source = NULL;
+    image->words = NULL;
+    image->line = NULL;
+    image->numWords = 0;
+}
+
+/* read a whole file into a malloc'd buffer; NULL if out of memory */
+char *
+readSource(FILE *filePtr, size_t *length)
+{
+    size_t size = 4096, got;
+    char *buffer = malloc(size), *bigger;
+
+    *length = 0;
+    while (buffer != NULL &&
+	    (got = fread(buffer + *length, 1, size - *length, filePtr)) > 0) {
+	*length += got;
+	if (*length == size) {
+	    size *= 2;
+	    bigger = realloc(buffer, size);
+	    if (bigger == NULL) {
+		free(buffer);
+	    }
+	    buffer = bigger;
+	}
+    }
+    return(buffer);
 }
 
+#ifndef LC3101_LIBRARY
+/*
+ * main function
+ */
+int
+main(int argc, char *argv[])
+{
+    char *inFileString, *outFileString, *mapFileString;
+    FILE *inFilePtr, *outFilePtr, *mapFilePtr;
+    char *source;
+    size_t length;
+    imageType image;
+    int address;
+    int flags = 0;
+    int status;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "O")) != -1) {
+	if (opt == 'O') {
+	    flags |= LC_OPTIMIZE;
+	} else {
+	    optind = argc + 1;
+	    break;
+	}
+    }
+
+    if (argc - optind != 2 && argc - optind != 3) {
+	printf("error: usage: %s [-O] <assembly-code-file> <machine-code-file> [<debug-map-file>]\n",
+	    argv[0]);
+	exit(1);
+    }
+
+    inFileString = argv[optind];
+    outFileString = argv[optind+1];
+    mapFileString = (argc - optind == 3) ? argv[optind+2] : NULL;
+
+    inFilePtr = fopen(inFileString, "r");
+    if (inFilePtr == NULL) {
+	printf("error in opening %s\n", inFileString);
+	exit(1);
+    }
+    outFilePtr = fopen(outFileString, "w");
+    if (outFilePtr == NULL) {
+	printf("error in opening %s\n", outFileString);
+	exit(1);
+    }
+    mapFilePtr = NULL;
+    if (mapFileString != NULL) {
+	mapFilePtr = fopen(mapFileString, "w");
+	if (mapFilePtr == NULL) {
+	    printf("error in opening %s\n", mapFileString);
+	    exit(1);
+	}
+	fprintf(mapFilePtr, "# address line label source\n");
+	flags |= LC_SOURCE;
+    }
+
+    source = readSource(inFilePtr, &length);
+    if (source == NULL) {
+	printf("error: out of memory\n");
+	exit(1);
+    }
+    status = assemble(source, length, flags, &image);
+    if (status != LC_OK) {
+	printf("%s\n", image.error);
+	exit(status);
+    }
+    if (image.report != NULL) {
+	fputs(image.report, stdout);
+    }
+
+    for (address=0; address<image.numWords; address++) {
+	fprintf(outFilePtr, "%d\n", image.words[address]);
+    }
+
+    /* debug map: one line per word, with the word's source line */
+    if (mapFilePtr != NULL) {
+	for (address=0; address<image.numWords; address++) {
+	    fprintf(mapFilePtr, "%d %d %s\n", address, image.line[address],
+		image.source[address]);
+	}
+	fclose(mapFilePtr);
+    }
+
+    exit(0);
+}
+#endif
@@ -0,0 +1,90 @@
+/*
+ * assemble and simulate LC3101 programs in one process: each source file
+ * is assembled into an in-memory image and loaded straight into a machine,
+ * with no machine-code file in between
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "lc3101.h"
+
+//assemble and run one file; returns its status
+int asmrun(char *fileName, int flags) {
+
+    FILE *filePtr;
+    char *source;
+    size_t length;
+    imageType image;
+    machineType *machine;
+    int status;
+
+    filePtr = fopen(fileName, "r");
+    if (filePtr == NULL) {
+        printf("%s: error in opening file\n", fileName);
+        return LC_ERROR;
+    }
+    source = readSource(filePtr, &length);
+    fclose(filePtr);
+    if (source == NULL) {
+        printf("%s: error: out of memory\n", fileName);
+        return LC_ERROR;
+    }
+
+    status = assemble(source, length, flags, &image);
+    free(source);
+    if (status != LC_OK) {
+        printf("%s: %s\n", fileName, image.error);
+        return status;
+    }
+    status = load(&image, &machine);
+    freeImage(&image);
+    if (status != LC_OK) {
+        printf("%s: error: out of memory\n", fileName);
+        return status;
+    }
+
+    printf("%s:\n", fileName);
+    status = run(machine);
+    unload(machine);
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    int flags = 0, status = LC_OK, fileStatus, opt, i;
+
+    traceEnabled = 0;
+    while ((opt = getopt(argc, argv, "Ot")) != -1)
+    {
+        if (opt == 'O')
+        {
+            flags |= LC_OPTIMIZE;
+        }
+        else if (opt == 't')
+        {
+            traceEnabled = 1;
+        }
+        else
+        {
+            optind = argc + 1;
+            break;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        printf("error: usage: %s [-O] [-t] <assembly-code-file>...\n", argv[0]);
+        exit(1);
+    }
+
+    /* keep going after a bad program; exit with the worst status */
+    for (i = optind; i < argc; i++)
+    {
+        fileStatus = asmrun(argv[i], flags);
+        if (fileStatus > status)
+        {
+            status = fileStatus;
+        }
+    }
+    exit(status);
+}
@@ -0,0 +1,648 @@
+/*
+ * lane-parallel batch simulator for many independent LC3101 programs.
+ * The vector path is only compiled for AVX2 targets:
+ *
+ *     gcc -O2 -mavx2 -o batchsim batchsim.c     (AVX2, 8 lanes per step)
+ *     gcc -O2 -o batchsim batchsim.c            (scalar)
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#define NUMMEMORY 65536 /* maximum number of data words in memory */
+#define NUMREGS 8 /* number of machine registers */
+#define MAXLINELENGTH 1000
+#define NUMLANES 16 /* machines stepped in lockstep, a multiple of 8 */
+
+#define ADD 0
+#define NAND 1
+#define LW 2
+#define SW 3
+#define BEQ 4
+#define JALR 5 /* JALR will not implemented for Project 2 */
+#define HALT 6
+#define NOOP 7
+
+#define LANE_IDLE 0
+#define LANE_RUNNING (-1) /* all ones, so it doubles as a vector mask */
+
+#define JOB_HALTED 0
+#define JOB_FAULT 1
+#define JOB_LIMIT 2 /* stopped at the -m cycle limit */
+
+#define MAXSTEPCYCLES 5 /* most cycles one step can charge a lane */
+
+/*
+ * Each lane executes one instruction per step and charges the cycles the
+ * pipeline in testsim would spend on it: one per instruction, one per
+ * load-use stall (an lw followed by an instruction whose regA or regB
+ * field names its regB, the stallHazard rule), three per taken beq, and
+ * three to drain the pipeline at halt.  Registers, memory and cycles at
+ * halt match run(); pc and the latches are not modelled.  A lane still
+ * running after -m cycles is stopped with JOB_LIMIT, so a program that
+ * never halts cannot hold up the rest of the batch.
+ */
+typedef struct batchStruct {
+    int pc[NUMLANES];
+    int reg[NUMREGS][NUMLANES];
+    int cycles[NUMLANES];
+    int retired[NUMLANES];
+    int prevDest[NUMLANES]; /* regB of an lw just executed, else -1 */
+    int active[NUMLANES]; /* LANE_RUNNING or LANE_IDLE */
+    int job[NUMLANES];
+    int hiWater[NUMLANES]; /* one past the highest word touched */
+    int *instrMem; /* NUMLANES blocks of NUMMEMORY words */
+    int *dataMem;
+} batchType;
+
+typedef struct jobStruct {
+    char *fileName;
+    int numMemory;
+    int *image;
+    int status;
+    int faultAddress;
+    int cycles;
+    int retired;
+    int reg[NUMREGS];
+    int *dataMem; /* final contents of the first numMemory words */
+} jobType;
+
+void readImage(jobType *job);
+void loadLane(batchType *batch, int lane, jobType *job);
+void finishLane(batchType *batch, int lane, jobType *jobs, int status,
+    int faultAddress);
+int stepScalar(batchType *batch, int base, int *events);
+int stepVector(batchType *batch, int base, int *events);
+void printJob(jobType *job);
+int field0(int instruction);
+int field1(int instruction);
+int field2(int instruction);
+int opcode(int instruction);
+int convertNum(int num);
+
+int main(int argc, char *argv[])
+{
+    batchType *batch;
+    jobType *jobs;
+    int numJobs, nextJob, running, stopped, repeat = 1, quiet = 0;
+    int lane, base, opt, i, r, events[NUMLANES];
+    int maxCycles = 1000000, safeSteps = 0;
+    long long instructions = 0;
+    struct timespec start, end;
+    double seconds;
+
+    while ((opt = getopt(argc, argv, "b:m:q")) != -1)
+    {
+        if (opt == 'b' && atoi(optarg) > 0)
+        {
+            repeat = atoi(optarg);
+        }
+        else if (opt == 'm' && atoi(optarg) > 0)
+        {
+            maxCycles = atoi(optarg);
+        }
+        else if (opt == 'q')
+        {
+            quiet = 1;
+        }
+        else
+        {
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind >= argc)
+    {
+        printf("error: usage: %s [-b repeat] [-m max-cycles] [-q] <machine-code file>...\n",
+               argv[0]);
+        exit(1);
+    }
+
+    /* -b repeats the list of programs, for throughput measurements */
+    numJobs = (argc - optind) * repeat;
+    jobs = calloc(numJobs, sizeof(jobType));
+    batch = calloc(1, sizeof(batchType));
+    if (jobs == NULL || batch == NULL)
+    {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    batch->instrMem = calloc((size_t) NUMLANES * NUMMEMORY, sizeof(int));
+    batch->dataMem = calloc((size_t) NUMLANES * NUMMEMORY, sizeof(int));
+    if (batch->instrMem == NULL || batch->dataMem == NULL)
+    {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < argc - optind; i++)
+    {
+        jobs[i].fileName = argv[optind + i];
+        readImage(&jobs[i]);
+    }
+    for (r = 1; r < repeat; r++)
+    {
+        for (i = 0; i < argc - optind; i++)
+        {
+            jobs[r * (argc - optind) + i] = jobs[i];
+        }
+    }
+    for (i = 0; i < numJobs; i++)
+    {
+        jobs[i].dataMem = malloc(jobs[i].numMemory * sizeof(int) + 1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    memset(events, 0, sizeof(events));
+    for (lane = 0, nextJob = 0; lane < NUMLANES && nextJob < numJobs; lane++)
+    {
+        loadLane(batch, lane, &jobs[nextJob++]);
+        batch->job[lane] = nextJob - 1;
+    }
+
+    /* step every lane until all jobs are done, refilling stopped lanes */
+    for (running = nextJob; running > 0; )
+    {
+        stopped = 0;
+        for (base = 0; base < NUMLANES; base += 8)
+        {
+#ifdef __AVX2__
+            stopped += stepVector(batch, base, events);
+#else
+            stopped += stepScalar(batch, base, events);
+#endif
+        }
+
+        /*
+         * retire lanes that reach the cycle limit.  A step charges at most
+         * MAXSTEPCYCLES, so the lanes are only scanned when the one closest
+         * to the limit could have reached it; a freshly loaded lane is
+         * never closer than maxCycles / MAXSTEPCYCLES steps.
+         */
+        if (--safeSteps <= 0)
+        {
+            safeSteps = maxCycles / MAXSTEPCYCLES;
+            for (lane = 0; lane < NUMLANES; lane++)
+            {
+                if (batch->active[lane] == LANE_IDLE || events[lane])
+                {
+                    continue;
+                }
+                if (batch->cycles[lane] >= maxCycles)
+                {
+                    events[lane] = 1 + JOB_LIMIT;
+                    batch->active[lane] = LANE_IDLE;
+                    stopped++;
+                }
+                else if ((maxCycles - batch->cycles[lane]) / MAXSTEPCYCLES < safeSteps)
+                {
+                    safeSteps = (maxCycles - batch->cycles[lane]) / MAXSTEPCYCLES;
+                }
+            }
+        }
+        if (stopped == 0)
+        {
+            continue;
+        }
+
+        for (lane = 0; lane < NUMLANES; lane++)
+        {
+            if (events[lane])
+            {
+                finishLane(batch, lane, jobs, events[lane] - 1,
+                           batch->pc[lane]);
+                events[lane] = 0;
+                if (nextJob < numJobs)
+                {
+                    loadLane(batch, lane, &jobs[nextJob]);
+                    batch->job[lane] = nextJob++;
+                }
+                else
+                {
+                    running--;
+                }
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    for (i = 0; i < numJobs; i++)
+    {
+        instructions += jobs[i].retired;
+        if (!quiet)
+        {
+            printJob(&jobs[i]);
+        }
+    }
+#ifdef __AVX2__
+    printf("%d programs, %lld instructions in %.6f s (%d lanes, AVX2)\n",
+           numJobs, instructions, seconds, NUMLANES);
+#else
+    printf("%d programs, %lld instructions in %.6f s (%d lanes, scalar)\n",
+           numJobs, instructions, seconds, NUMLANES);
+#endif
+
+    return (0);
+}
+
+//read a machine-code file, as testsim does
+void readImage(jobType *job)
+{
+    char line[MAXLINELENGTH];
+    FILE *filePtr = fopen(job->fileName, "r");
+
+    if (filePtr == NULL)
+    {
+        printf("error: can't open file %s\n", job->fileName);
+        exit(1);
+    }
+    job->image = malloc(NUMMEMORY * sizeof(int));
+    for (job->numMemory = 0; fgets(line, MAXLINELENGTH, filePtr) != NULL;
+         job->numMemory++)
+    {
+        if (job->numMemory >= NUMMEMORY ||
+            sscanf(line, "%d", job->image + job->numMemory) != 1)
+        {
+            printf("error in reading address %d of %s\n", job->numMemory,
+                   job->fileName);
+            exit(1);
+        }
+    }
+    fclose(filePtr);
+}
+
+void loadLane(batchType *batch, int lane, jobType *job)
+{
+    int *instrMem = batch->instrMem + (size_t) lane * NUMMEMORY;
+    int *dataMem = batch->dataMem + (size_t) lane * NUMMEMORY;
+    int r;
+
+    /* only the words the previous job could have touched are dirty */
+    memset(instrMem, 0, batch->hiWater[lane] * sizeof(int));
+    memset(dataMem, 0, batch->hiWater[lane] * sizeof(int));
+    memcpy(instrMem, job->image, job->numMemory * sizeof(int));
+    memcpy(dataMem, job->image, job->numMemory * sizeof(int));
+    batch->hiWater[lane] = job->numMemory;
+
+    batch->pc[lane] = 0;
+    for (r = 0; r < NUMREGS; r++)
+    {
+        batch->reg[r][lane] = 0;
+    }
+    batch->cycles[lane] = 0;
+    batch->retired[lane] = 0;
+    batch->prevDest[lane] = -1;
+    batch->active[lane] = LANE_RUNNING;
+}
+
+void finishLane(batchType *batch, int lane, jobType *jobs, int status,
+                int faultAddress)
+{
+    jobType *job = &jobs[batch->job[lane]];
+    int r;
+
+    job->status = status;
+    job->faultAddress = faultAddress;
+    job->cycles = batch->cycles[lane];
+    job->retired = batch->retired[lane];
+    for (r = 0; r < NUMREGS; r++)
+    {
+        job->reg[r] = batch->reg[r][lane];
+    }
+    memcpy(job->dataMem, batch->dataMem + (size_t) lane * NUMMEMORY,
+           job->numMemory * sizeof(int));
+    batch->active[lane] = LANE_IDLE;
+}
+
+/*
+ * one instruction on lanes base..base+7.  events[lane] is set to 1 +
+ * JOB_HALTED or 1 + JOB_FAULT when a lane stops; on a fault pc holds the
+ * offending address and the faulting instruction is neither charged nor
+ * retired.  Returns the number of lanes that stopped.
+ */
+int stepScalar(batchType *batch, int base, int *events)
+{
+    int lane, pc, instr, code, regA, regB, addr, dest, next, stopped = 0;
+    int *instrMem, *dataMem;
+
+    for (lane = base; lane < base + 8; lane++)
+    {
+        if (batch->active[lane] == LANE_IDLE)
+        {
+            continue;
+        }
+        instrMem = batch->instrMem + (size_t) lane * NUMMEMORY;
+        dataMem = batch->dataMem + (size_t) lane * NUMMEMORY;
+        pc = batch->pc[lane];
+        if (pc < 0 || pc >= NUMMEMORY)
+        {
+            events[lane] = 1 + JOB_FAULT;
+            batch->active[lane] = LANE_IDLE;
+            stopped++;
+            continue;
+        }
+
+        instr = instrMem[pc];
+        code = opcode(instr);
+        regA = batch->reg[field0(instr)][lane];
+        regB = batch->reg[field1(instr)][lane];
+        addr = regA + convertNum(field2(instr));
+
+        /* a lw or sw outside memory faults before it is charged or retired */
+        if ((code == LW || code == SW) && (addr < 0 || addr >= NUMMEMORY))
+        {
+            batch->pc[lane] = addr;
+            events[lane] = 1 + JOB_FAULT;
+            batch->active[lane] = LANE_IDLE;
+            stopped++;
+            continue;
+        }
+
+        batch->cycles[lane] += 1 + (batch->prevDest[lane] == field0(instr) ||
+                                    batch->prevDest[lane] == field1(instr));
+        batch->retired[lane]++;
+        batch->prevDest[lane] = (code == LW) ? field1(instr) : -1;
+        next = pc + 1;
+
+        if (code == ADD || code == NAND)
+        {
+            dest = field2(instr);
+            if (dest < NUMREGS)
+            {
+                batch->reg[dest][lane] = (code == ADD) ? regA + regB
+                                                       : ~(regA & regB);
+            }
+        }
+        else if (code == LW || code == SW)
+        {
+            if (code == LW)
+            {
+                batch->reg[field1(instr)][lane] = dataMem[addr];
+            }
+            else
+            {
+                dataMem[addr] = regB;
+                if (addr >= batch->hiWater[lane])
+                {
+                    batch->hiWater[lane] = addr + 1;
+                }
+            }
+        }
+        else if (code == BEQ && regA == regB)
+        {
+            batch->cycles[lane] += 3;
+            next = pc + 1 + convertNum(field2(instr));
+        }
+        else if (code == HALT)
+        {
+            batch->cycles[lane] += 3;
+            events[lane] = 1 + JOB_HALTED;
+            batch->active[lane] = LANE_IDLE;
+            stopped++;
+        }
+        batch->pc[lane] = next;
+    }
+    return stopped;
+}
+
+#ifdef __AVX2__
+//stepScalar on eight lanes at once; stores and faults fall back to scalar
+int stepVector(batchType *batch, int base, int *events)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i three = _mm256_set1_epi32(3);
+    const __m256i seven = _mm256_set1_epi32(7);
+    const __m256i ones = _mm256_set1_epi32(-1);
+    const __m256i limit = _mm256_set1_epi32(NUMMEMORY - 1);
+    __m256i lane, memBase, active, pc, instr, code, f0, f1, f2, offset;
+    __m256i regA, regB, prevDest, stall, isAdd, isNand, isLw, isSw, isBeq;
+    __m256i isHalt, addr, badAddr, badPc, loaded, value, dest, writes, mask;
+    __m256i taken, next, cycles, r;
+    int bits, i, l, addrs[8], values[8], stopped = 0;
+
+    active = _mm256_loadu_si256((__m256i *) &batch->active[base]);
+    if (_mm256_testz_si256(active, active))
+    {
+        return 0;
+    }
+    lane = _mm256_add_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                            _mm256_set1_epi32(base));
+    memBase = _mm256_slli_epi32(lane, 16); /* lane * NUMMEMORY */
+    pc = _mm256_loadu_si256((__m256i *) &batch->pc[base]);
+
+    /* pc outside memory: fault before fetching */
+    badPc = _mm256_and_si256(active, _mm256_or_si256(
+        _mm256_cmpgt_epi32(zero, pc), _mm256_cmpgt_epi32(pc, limit)));
+    if (!_mm256_testz_si256(badPc, badPc))
+    {
+        bits = _mm256_movemask_ps(_mm256_castsi256_ps(badPc));
+        for (i = 0; i < 8; i++)
+        {
+            if (bits & (1 << i))
+            {
+                events[base + i] = 1 + JOB_FAULT;
+                stopped++;
+            }
+        }
+        active = _mm256_andnot_si256(badPc, active);
+    }
+
+    instr = _mm256_mask_i32gather_epi32(zero, batch->instrMem,
+                                        _mm256_add_epi32(memBase, pc),
+                                        active, 4);
+    code = _mm256_srai_epi32(instr, 22);
+    f0 = _mm256_and_si256(_mm256_srli_epi32(instr, 19), seven);
+    f1 = _mm256_and_si256(_mm256_srli_epi32(instr, 16), seven);
+    f2 = _mm256_and_si256(instr, _mm256_set1_epi32(0xFFFF));
+    offset = _mm256_srai_epi32(_mm256_slli_epi32(instr, 16), 16);
+
+    /* reg is [NUMREGS][NUMLANES]: element r * NUMLANES + lane */
+    regA = _mm256_i32gather_epi32(&batch->reg[0][0], _mm256_add_epi32(
+        _mm256_slli_epi32(f0, 4), lane), 4);
+    regB = _mm256_i32gather_epi32(&batch->reg[0][0], _mm256_add_epi32(
+        _mm256_slli_epi32(f1, 4), lane), 4);
+
+    isAdd = _mm256_cmpeq_epi32(code, _mm256_set1_epi32(ADD));
+    isNand = _mm256_cmpeq_epi32(code, _mm256_set1_epi32(NAND));
+    isLw = _mm256_and_si256(active, _mm256_cmpeq_epi32(code,
+                                                       _mm256_set1_epi32(LW)));
+    isSw = _mm256_and_si256(active, _mm256_cmpeq_epi32(code,
+                                                       _mm256_set1_epi32(SW)));
+    isBeq = _mm256_cmpeq_epi32(code, _mm256_set1_epi32(BEQ));
+    isHalt = _mm256_and_si256(active, _mm256_cmpeq_epi32(code,
+                                                         _mm256_set1_epi32(HALT)));
+
+    /* lw/sw address outside memory: fault, leaving the lane untouched */
+    addr = _mm256_add_epi32(regA, offset);
+    badAddr = _mm256_and_si256(_mm256_or_si256(isLw, isSw), _mm256_or_si256(
+        _mm256_cmpgt_epi32(zero, addr), _mm256_cmpgt_epi32(addr, limit)));
+    _mm256_storeu_si256((__m256i *) addrs, addr);
+    if (!_mm256_testz_si256(badAddr, badAddr))
+    {
+        bits = _mm256_movemask_ps(_mm256_castsi256_ps(badAddr));
+        for (i = 0; i < 8; i++)
+        {
+            if (bits & (1 << i))
+            {
+                events[base + i] = 1 + JOB_FAULT;
+                stopped++;
+            }
+        }
+        active = _mm256_andnot_si256(badAddr, active);
+        isLw = _mm256_andnot_si256(badAddr, isLw);
+        isSw = _mm256_andnot_si256(badAddr, isSw);
+        isHalt = _mm256_and_si256(isHalt, active);
+    }
+
+    /* cycles: one, plus a load-use stall, plus squash and drain */
+    prevDest = _mm256_loadu_si256((__m256i *) &batch->prevDest[base]);
+    stall = _mm256_or_si256(_mm256_cmpeq_epi32(prevDest, f0),
+                            _mm256_cmpeq_epi32(prevDest, f1));
+    taken = _mm256_and_si256(_mm256_and_si256(isBeq, active),
+                             _mm256_cmpeq_epi32(regA, regB));
+    cycles = _mm256_sub_epi32(one, stall);
+    cycles = _mm256_add_epi32(cycles, _mm256_and_si256(
+        _mm256_or_si256(taken, isHalt), three));
+    cycles = _mm256_and_si256(cycles, active);
+    _mm256_storeu_si256((__m256i *) &batch->cycles[base], _mm256_add_epi32(
+        _mm256_loadu_si256((__m256i *) &batch->cycles[base]), cycles));
+    _mm256_storeu_si256((__m256i *) &batch->retired[base], _mm256_sub_epi32(
+        _mm256_loadu_si256((__m256i *) &batch->retired[base]), active));
+    prevDest = _mm256_blendv_epi8(ones, f1, isLw);
+    _mm256_storeu_si256((__m256i *) &batch->prevDest[base],
+                        _mm256_blendv_epi8(
+                            _mm256_loadu_si256((__m256i *) &batch->prevDest[base]),
+                            prevDest, active));
+
+    /* loads gather, stores are scattered one lane at a time */
+    loaded = _mm256_mask_i32gather_epi32(zero, batch->dataMem,
+                                         _mm256_add_epi32(memBase, addr),
+                                         isLw, 4);
+    if (!_mm256_testz_si256(isSw, isSw))
+    {
+        _mm256_storeu_si256((__m256i *) values, regB);
+        bits = _mm256_movemask_ps(_mm256_castsi256_ps(isSw));
+        for (i = 0; i < 8; i++)
+        {
+            if (bits & (1 << i))
+            {
+                l = base + i;
+                batch->dataMem[(size_t) l * NUMMEMORY + addrs[i]] = values[i];
+                if (addrs[i] >= batch->hiWater[l])
+                {
+                    batch->hiWater[l] = addrs[i] + 1;
+                }
+            }
+        }
+    }
+
+    /* write back with one blend per register instead of a scatter */
+    value = _mm256_blendv_epi8(loaded, _mm256_add_epi32(regA, regB), isAdd);
+    value = _mm256_blendv_epi8(value, _mm256_xor_si256(
+        _mm256_and_si256(regA, regB), ones), isNand);
+    dest = _mm256_blendv_epi8(f2, f1, isLw);
+    writes = _mm256_and_si256(active, _mm256_or_si256(
+        _mm256_or_si256(isAdd, isNand), isLw));
+    for (i = 0; i < NUMREGS; i++)
+    {
+        mask = _mm256_and_si256(writes, _mm256_cmpeq_epi32(
+            dest, _mm256_set1_epi32(i)));
+        r = _mm256_loadu_si256((__m256i *) &batch->reg[i][base]);
+        _mm256_storeu_si256((__m256i *) &batch->reg[i][base],
+                            _mm256_blendv_epi8(r, value, mask));
+    }
+
+    /* next pc */
+    next = _mm256_add_epi32(pc, one);
+    next = _mm256_blendv_epi8(next, _mm256_add_epi32(next, offset), taken);
+    next = _mm256_blendv_epi8(pc, next, active);
+    _mm256_storeu_si256((__m256i *) &batch->pc[base],
+                        _mm256_blendv_epi8(next, addr, badAddr));
+
+    if (!_mm256_testz_si256(isHalt, isHalt))
+    {
+        bits = _mm256_movemask_ps(_mm256_castsi256_ps(isHalt));
+        for (i = 0; i < 8; i++)
+        {
+            if (bits & (1 << i))
+            {
+                events[base + i] = 1 + JOB_HALTED;
+                stopped++;
+            }
+        }
+    }
+    for (i = 0; stopped && i < 8; i++)
+    {
+        if (events[base + i])
+        {
+            batch->active[base + i] = LANE_IDLE;
+        }
+    }
+    return stopped;
+}
+#endif
+
+//final state, in the format of testsim's last printState
+void printJob(jobType *job)
+{
+    int i;
+
+    printf("%s:\n", job->fileName);
+    if (job->status == JOB_FAULT)
+    {
+        printf("machine fault at address %d\n", job->faultAddress);
+    }
+    else if (job->status == JOB_LIMIT)
+    {
+        printf("machine did not halt; stopped at the cycle limit\n");
+    }
+    else
+    {
+        printf("machine halted\n");
+    }
+    printf("total of %d cycles executed\n", job->cycles);
+    printf("\tdata memory:\n");
+    for (i = 0; i < job->numMemory; i++)
+    {
+        printf("\t\tdataMem[ %d ] %d\n", i, job->dataMem[i]);
+    }
+    printf("\tregisters:\n");
+    for (i = 0; i < NUMREGS; i++)
+    {
+        printf("\t\treg[ %d ] %d\n", i, job->reg[i]);
+    }
+}
+
+int field0(int instruction) {
+    return( (instruction>>19) & 0x7);
+}
+
+int field1(int instruction) {
+    return( (instruction>>16) & 0x7);
+}
+
+int field2(int instruction) {
+    return(instruction & 0xFFFF);
+}
+
+int opcode(int instruction) {
+    return(instruction>>22);
+}
+
+int convertNum(int num)
+{
+    /* convert a 16-bit number into a 32-bit Sun integer */
+    if (num & (1 << 15))
+    {
+        num -= (1 << 16);
+    }
+    return (num);
+}
@@ -0,0 +1,76 @@
+/*
+ * LC3101 assembler and simulator as a library.  The assembler (LC3101a.c)
+ * and the simulator (testsim.c) each keep their command-line main, which
+ * is left out when they are compiled with -DLC3101_LIBRARY, e.g.
+ *
+ *     gcc -O2 -pthread -DLC3101_LIBRARY -o asmrun asmrun.c LC3101a.c testsim.c -lm
+ *
+ * Nothing in the library exits; every call returns one of the status codes
+ * below, which are also the command-line tools' exit statuses.
+ */
+#ifndef LC3101_H
+#define LC3101_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define LC_OK 0
+#define LC_ERROR 1 /* bad program, machine fault or out of memory */
+#define LC_BADARG 2 /* malformed register, address field or label */
+#define LC_LIMIT 3 /* runHashed() reached its cycle limit */
+
+/* assemble() flags */
+#define LC_OPTIMIZE 1 /* run the scheduling pass (assembler -O) */
+#define LC_SOURCE 2 /* keep each word's source text for a debug map */
+
+#define LC_MAXERROR 1100
+
+/* a program as machine words, from assemble() or readMachineCode() */
+typedef struct imageStruct {
+    int numWords;
+    int *words;
+    int *line; /* source line of each word, or NULL */
+    char **source; /* "label opcode args" of each word, or NULL */
+    char *report; /* what LC_OPTIMIZE changed, as text, or NULL */
+    char error[LC_MAXERROR]; /* message for a failed call */
+} imageType;
+
+/* the simulator's pipeline state */
+typedef struct stateStruct machineType;
+
+/* rolling hash of the machine state, one per cycle */
+typedef unsigned long long hashType;
+
+/* assembler */
+char *readSource(FILE *filePtr, size_t *length);
+int assemble(const char *source, size_t length, int flags, imageType *image);
+void freeImage(imageType *image);
+
+/* simulator */
+extern int traceEnabled;
+int readMachineCode(FILE *filePtr, imageType *image);
+int load(const imageType *image, machineType **machine);
+int run(machineType *machine);
+int runHashed(machineType *machine, hashType *hashes, int limit,
+    int *numHashes);
+void printState(machineType *machine);
+void unload(machineType *machine);
+
+/*
+ * memory-access log written by the simulator's -m option and read by
+ * memanalyze: a memLogHeaderType followed by memRecordType records
+ */
+#define MEMLOGMAGIC 0x544d434c /* "LCMT" */
+
+typedef struct memLogHeaderStruct {
+    unsigned int magic;
+    unsigned int recordSize;
+} memLogHeaderType;
+
+typedef struct memRecordStruct {
+    unsigned int cycleRw; /* cycle << 1, | 1 for a store */
+    unsigned short pc;
+    unsigned short addr;
+} memRecordType;
+
+#endif
@@ -0,0 +1,337 @@
+/* offline locality analysis of a testsim -m memory-access log */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "lc3101.h"
+
+#define NUMMEMORY 65536 /* maximum number of data words in memory */
+#define NUMBUCKETS 18 /* reuse distances 0, 1, 2-3, ... up to 65536 */
+#define MAXSTRIDEPCS 20 /* pcs listed in the stride report */
+
+/* per-pc stride tracking */
+typedef struct strideStruct {
+    long long accesses;
+    long long repeats; /* accesses whose stride equals the previous one */
+    int lastAddr;
+    int lastStride;
+} strideType;
+
+memRecordType *readLog(char *fileName, long long *numRecords);
+void reuseDistance(memRecordType *records, long long numRecords);
+void workingSet(memRecordType *records, long long numRecords, int window);
+void strides(memRecordType *records, long long numRecords);
+int bucketOf(long long distance);
+
+int main(int argc, char *argv[])
+{
+    memRecordType *records;
+    long long numRecords, stores = 0, i;
+    int window = 1000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:")) != -1)
+    {
+        if (opt == 'w' && atoi(optarg) > 0)
+        {
+            window = atoi(optarg);
+        }
+        else
+        {
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (argc - optind != 1)
+    {
+        printf("error: usage: %s [-w window-cycles] <access-log>\n", argv[0]);
+        exit(1);
+    }
+
+    records = readLog(argv[optind], &numRecords);
+    for (i = 0; i < numRecords; i++)
+    {
+        stores += records[i].cycleRw & 1;
+    }
+    printf("%lld accesses: %lld loads, %lld stores\n", numRecords,
+           numRecords - stores, stores);
+    if (numRecords == 0)
+    {
+        return (0);
+    }
+
+    reuseDistance(records, numRecords);
+    workingSet(records, numRecords, window);
+    strides(records, numRecords);
+
+    return (0);
+}
+
+memRecordType *readLog(char *fileName, long long *numRecords)
+{
+    memLogHeaderType header;
+    memRecordType *records;
+    FILE *filePtr;
+    long size;
+
+    filePtr = fopen(fileName, "rb");
+    if (filePtr == NULL)
+    {
+        printf("error: can't open file %s\n", fileName);
+        exit(1);
+    }
+    if (fread(&header, sizeof(header), 1, filePtr) != 1 ||
+        header.magic != MEMLOGMAGIC ||
+        header.recordSize != sizeof(memRecordType))
+    {
+        printf("error: %s is not a memory-access log\n", fileName);
+        exit(1);
+    }
+
+    fseek(filePtr, 0, SEEK_END);
+    size = ftell(filePtr) - (long) sizeof(header);
+    fseek(filePtr, sizeof(header), SEEK_SET);
+    *numRecords = size / sizeof(memRecordType);
+
+    records = malloc((*numRecords + 1) * sizeof(memRecordType));
+    if (records == NULL ||
+        (long long) fread(records, sizeof(memRecordType), *numRecords,
+                          filePtr) != *numRecords)
+    {
+        printf("error in reading %s\n", fileName);
+        exit(1);
+    }
+    fclose(filePtr);
+    return records;
+}
+
+//bucket 0 holds distance 0, bucket b > 0 holds [2^(b-1), 2^b)
+int bucketOf(long long distance)
+{
+    int b = 0;
+
+    while (distance > 0)
+    {
+        distance >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/*
+ * LRU stack distance: the number of distinct addresses touched since the
+ * previous access to the same address.  A Fenwick tree over access times
+ * marks the latest access of every address, so each distance is the
+ * number of marks after that address's previous access.
+ */
+void reuseDistance(memRecordType *records, long long numRecords)
+{
+    long long *tree = calloc(numRecords + 1, sizeof(long long));
+    long long *last = malloc(NUMMEMORY * sizeof(long long));
+    long long histogram[NUMBUCKETS + 1];
+    long long cold = 0, distance, hits, i, j;
+    int addr, b, size;
+
+    if (tree == NULL || last == NULL)
+    {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    memset(histogram, 0, sizeof(histogram));
+    for (addr = 0; addr < NUMMEMORY; addr++)
+    {
+        last[addr] = -1;
+    }
+
+    for (i = 0; i < numRecords; i++)
+    {
+        addr = records[i].addr;
+        if (last[addr] < 0)
+        {
+            cold++;
+        }
+        else
+        {
+            /* marks in (last, i) = prefix(i) - prefix(last + 1) */
+            distance = 0;
+            for (j = i; j > 0; j -= j & -j)
+            {
+                distance += tree[j];
+            }
+            for (j = last[addr] + 1; j > 0; j -= j & -j)
+            {
+                distance -= tree[j];
+            }
+            histogram[bucketOf(distance)]++;
+            for (j = last[addr] + 1; j <= numRecords; j += j & -j)
+            {
+                tree[j]--;
+            }
+        }
+        for (j = i + 1; j <= numRecords; j += j & -j)
+        {
+            tree[j]++;
+        }
+        last[addr] = i;
+    }
+
+    printf("\nreuse distance (distinct addresses between reuses):\n");
+    printf("%14s %12s\n", "distance", "accesses");
+    printf("%14s %12lld\n", "cold", cold);
+    for (b = 0; b <= NUMBUCKETS; b++)
+    {
+        if (histogram[b] == 0)
+        {
+            continue;
+        }
+        if (b <= 1)
+        {
+            printf("%14d %12lld\n", b, histogram[b]);
+        }
+        else
+        {
+            printf("%6lld-%-7lld %12lld\n", 1LL << (b - 1), (1LL << b) - 1,
+                   histogram[b]);
+        }
+    }
+
+    /* a fully associative LRU cache of size words hits every reuse with
+       distance < size; bucket b is entirely below 2^b */
+    printf("\nfully associative LRU hit rate by size (words):\n");
+    for (size = 1, b = 0; size <= NUMMEMORY; size <<= 1)
+    {
+        for (hits = 0, b = 0; b <= NUMBUCKETS && (1LL << b) <= size; b++)
+        {
+            hits += histogram[b];
+        }
+        printf("%14d %11.2f%%\n", size, 100.0 * hits / numRecords);
+        if (hits + cold == numRecords)
+        {
+            break;
+        }
+    }
+
+    free(tree);
+    free(last);
+}
+
+//distinct addresses touched in each window of cycles
+void workingSet(memRecordType *records, long long numRecords, int window)
+{
+    int *stamp = malloc(NUMMEMORY * sizeof(int));
+    long long i, windows = 0, sum = 0;
+    int current = -1, size = 0, maxSize = 0, id, addr;
+
+    if (stamp == NULL)
+    {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    for (addr = 0; addr < NUMMEMORY; addr++)
+    {
+        stamp[addr] = -1;
+    }
+
+    printf("\nworking set per %d cycles:\n", window);
+    printf("%14s %12s\n", "cycle", "words");
+    for (i = 0; i <= numRecords; i++)
+    {
+        id = (i < numRecords) ? (int) ((records[i].cycleRw >> 1) / window)
+                              : -2;
+        if (id != current)
+        {
+            if (current >= 0)
+            {
+                printf("%14lld %12d\n", (long long) current * window, size);
+                windows++;
+                sum += size;
+                if (size > maxSize)
+                {
+                    maxSize = size;
+                }
+            }
+            current = id;
+            size = 0;
+        }
+        if (i < numRecords)
+        {
+            addr = records[i].addr;
+            if (stamp[addr] != id)
+            {
+                stamp[addr] = id;
+                size++;
+            }
+        }
+    }
+    printf("average %.2f words, maximum %d words over %lld active windows\n",
+           (double) sum / windows, maxSize, windows);
+    free(stamp);
+}
+
+int strideCompare(const void *a, const void *b)
+{
+    const strideType *sa = a, *sb = b;
+
+    if (sa->accesses != sb->accesses)
+    {
+        return (sa->accesses < sb->accesses) ? 1 : -1;
+    }
+    return 0;
+}
+
+//per-pc stride pattern: how often the address step repeats
+void strides(memRecordType *records, long long numRecords)
+{
+    static strideType table[NUMMEMORY];
+    static int pcOf[NUMMEMORY];
+    strideType *entry;
+    long long i;
+    int pc, stride, n;
+
+    for (i = 0; i < numRecords; i++)
+    {
+        entry = &table[records[i].pc];
+        stride = records[i].addr - entry->lastAddr;
+        if (entry->accesses >= 2 && stride == entry->lastStride)
+        {
+            entry->repeats++;
+        }
+        if (entry->accesses >= 1)
+        {
+            entry->lastStride = stride;
+        }
+        entry->lastAddr = records[i].addr;
+        entry->accesses++;
+    }
+
+    /* sort pcs by accesses, remembering which pc each entry was */
+    for (pc = 0, n = 0; pc < NUMMEMORY; pc++)
+    {
+        if (table[pc].accesses > 0)
+        {
+            pcOf[n] = pc;
+            table[n++] = table[pc];
+        }
+    }
+    for (i = 0; i < n; i++)
+    {
+        table[i].lastAddr = pcOf[i]; /* reuse lastAddr to carry the pc */
+    }
+    qsort(table, n, sizeof(strideType), strideCompare);
+
+    printf("\nstride patterns by pc:\n");
+    printf("%8s %12s %8s %9s  %s\n", "pc", "accesses", "stride", "repeat",
+           "pattern");
+    for (i = 0; i < n && i < MAXSTRIDEPCS; i++)
+    {
+        entry = &table[i];
+        printf("%8d %12lld %8d %8.2f%%  %s\n", entry->lastAddr,
+               entry->accesses, entry->accesses > 1 ? entry->lastStride : 0,
+               entry->accesses > 2
+                   ? 100.0 * entry->repeats / (entry->accesses - 2) : 0.0,
+               entry->accesses == 1 ? "single"
+               : entry->accesses > 2 && entry->repeats == entry->accesses - 2
+                   ? (entry->lastStride == 0 ? "constant" : "strided")
+                   : "irregular");
+    }
+}
@@ -0,0 +1,319 @@
+/*
+ * golden-trace regression runner.  Each program is assembled and run with
+ * runHashed(), which records one rolling hash of the machine state per
+ * cycle.  With -r the hashes are written next to the source as a golden
+ * file (tests/test0.as -> tests/test0.golden); otherwise they are checked
+ * against it.  Because every hash folds in the one before, a run agrees
+ * with its golden file up to some cycle and differs from then on, so the
+ * first diverging cycle is found by bisection and only that cycle's state
+ * is printed.  Programs run in parallel on -j threads; results are
+ * printed in argument order.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "lc3101.h"
+
+#define GOLDENMAGIC 0x484c4347 /* "GCLH" little-endian */
+#define MAXTHREADS 64
+
+/* golden file: this header, then numHashes hashes */
+typedef struct goldenHeaderStruct {
+    unsigned int magic;
+    int status; /* how the run ended: LC_OK (halt) or LC_ERROR (fault) */
+    int numHashes; /* cycles including the halting one */
+} goldenHeaderType;
+
+#define RESULT_OK 0
+#define RESULT_RECORDED 1
+#define RESULT_DIVERGED 2
+#define RESULT_ERROR 3 /* could not assemble, run or read the golden file */
+
+typedef struct jobStruct {
+    char *fileName;
+    char *goldenName;
+    int result;
+    int status;
+    int numHashes;
+    int goldenHashes;
+    int diverge; /* first cycle whose hash differs */
+    char message[LC_MAXERROR];
+} jobType;
+
+jobType *jobs;
+int numJobs;
+int nextJob;
+pthread_mutex_t jobLock = PTHREAD_MUTEX_INITIALIZER;
+int record = 0;
+int maxCycles = 1000000;
+
+//assemble and load fileName; returns the status with the message in job
+int loadProgram(jobType *job, machineType **machine) {
+
+    FILE *filePtr;
+    char *source;
+    size_t length;
+    imageType image;
+    int status;
+
+    filePtr = fopen(job->fileName, "r");
+    if (filePtr == NULL) {
+        snprintf(job->message, LC_MAXERROR, "error in opening file");
+        return LC_ERROR;
+    }
+    source = readSource(filePtr, &length);
+    fclose(filePtr);
+    if (source == NULL) {
+        snprintf(job->message, LC_MAXERROR, "error: out of memory");
+        return LC_ERROR;
+    }
+    status = assemble(source, length, 0, &image);
+    free(source);
+    if (status != LC_OK) {
+        snprintf(job->message, LC_MAXERROR, "%s", image.error);
+        return status;
+    }
+    status = load(&image, machine);
+    freeImage(&image);
+    if (status != LC_OK) {
+        snprintf(job->message, LC_MAXERROR, "error: out of memory");
+    }
+    return status;
+}
+
+int writeGolden(jobType *job, hashType *hashes) {
+
+    goldenHeaderType header;
+    FILE *filePtr = fopen(job->goldenName, "wb");
+
+    if (filePtr == NULL) {
+        snprintf(job->message, LC_MAXERROR, "error in opening %s", job->goldenName);
+        return RESULT_ERROR;
+    }
+    header.magic = GOLDENMAGIC;
+    header.status = job->status;
+    header.numHashes = job->numHashes;
+    fwrite(&header, sizeof(header), 1, filePtr);
+    fwrite(hashes, sizeof(hashType), job->numHashes, filePtr);
+    fclose(filePtr);
+    return RESULT_RECORDED;
+}
+
+//compare hashes with the golden file, bisecting to the first difference
+int checkGolden(jobType *job, hashType *hashes) {
+
+    goldenHeaderType header;
+    hashType *golden;
+    FILE *filePtr = fopen(job->goldenName, "rb");
+    int lo, hi, mid, result;
+
+    if (filePtr == NULL) {
+        snprintf(job->message, LC_MAXERROR, "no golden file %s (record with -r)", job->goldenName);
+        return RESULT_ERROR;
+    }
+    if (fread(&header, sizeof(header), 1, filePtr) != 1 || header.magic != GOLDENMAGIC ||
+        header.numHashes < 0) {
+        fclose(filePtr);
+        snprintf(job->message, LC_MAXERROR, "bad golden file %s", job->goldenName);
+        return RESULT_ERROR;
+    }
+    golden = malloc(header.numHashes * sizeof(hashType) + 1);
+    if (golden == NULL ||
+        fread(golden, sizeof(hashType), header.numHashes, filePtr) != (size_t) header.numHashes) {
+        fclose(filePtr);
+        free(golden);
+        snprintf(job->message, LC_MAXERROR, "bad golden file %s", job->goldenName);
+        return RESULT_ERROR;
+    }
+    fclose(filePtr);
+    job->goldenHashes = header.numHashes;
+
+    /* hashes[0..lo) agree; the first difference is in [lo, hi] */
+    lo = 0;
+    hi = job->numHashes < header.numHashes ? job->numHashes : header.numHashes;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (hashes[mid] == golden[mid]) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    job->diverge = lo;
+    result = RESULT_OK;
+    if (lo < job->numHashes || lo < header.numHashes || job->status != header.status) {
+        result = RESULT_DIVERGED;
+    }
+    free(golden);
+    return result;
+}
+
+void runJob(jobType *job, hashType *hashes) {
+
+    machineType *machine;
+
+    if (loadProgram(job, &machine) != LC_OK) {
+        job->result = RESULT_ERROR;
+        return;
+    }
+    job->status = runHashed(machine, hashes, maxCycles, &job->numHashes);
+    unload(machine);
+    if (job->status == LC_LIMIT) {
+        snprintf(job->message, LC_MAXERROR, "did not halt within %d cycles", maxCycles);
+        job->result = RESULT_ERROR;
+    } else if (record) {
+        job->result = writeGolden(job, hashes);
+    } else {
+        job->result = checkGolden(job, hashes);
+    }
+}
+
+void *worker(void *arg) {
+
+    hashType *hashes = malloc(maxCycles * sizeof(hashType));
+    jobType *job;
+
+    (void) arg;
+    while (1) {
+        pthread_mutex_lock(&jobLock);
+        job = nextJob < numJobs ? &jobs[nextJob++] : NULL;
+        pthread_mutex_unlock(&jobLock);
+        if (job == NULL) {
+            break;
+        }
+        if (hashes == NULL) {
+            snprintf(job->message, LC_MAXERROR, "error: out of memory");
+            job->result = RESULT_ERROR;
+            continue;
+        }
+        runJob(job, hashes);
+    }
+    free(hashes);
+    return NULL;
+}
+
+//rerun a diverged program to its first diverging cycle and print that state
+void printDivergence(jobType *job) {
+
+    machineType *machine;
+    hashType *hashes = malloc((job->diverge + 1) * sizeof(hashType));
+    int numHashes;
+
+    if (hashes == NULL || loadProgram(job, &machine) != LC_OK) {
+        free(hashes);
+        return;
+    }
+    /* a run that ended first is shown at its last cycle */
+    runHashed(machine, hashes, job->diverge < job->numHashes ? job->diverge : job->numHashes - 1,
+              &numHashes);
+    printState(machine);
+    unload(machine);
+    free(hashes);
+}
+
+int main(int argc, char *argv[])
+{
+    pthread_t threads[MAXTHREADS];
+    int numThreads = 1, failed = 0, opt, i;
+    size_t length;
+
+    traceEnabled = 0;
+    while ((opt = getopt(argc, argv, "j:m:r")) != -1)
+    {
+        if (opt == 'j')
+        {
+            numThreads = atoi(optarg);
+        }
+        else if (opt == 'm')
+        {
+            maxCycles = atoi(optarg);
+        }
+        else if (opt == 'r')
+        {
+            record = 1;
+        }
+        else
+        {
+            optind = argc + 1;
+            break;
+        }
+    }
+
+    if (optind >= argc || maxCycles < 1)
+    {
+        printf("error: usage: %s [-r] [-j threads] [-m max-cycles] <assembly-code-file>...\n", argv[0]);
+        exit(1);
+    }
+    if (numThreads < 1)
+    {
+        numThreads = 1;
+    }
+    if (numThreads > MAXTHREADS)
+    {
+        numThreads = MAXTHREADS;
+    }
+
+    numJobs = argc - optind;
+    jobs = calloc(numJobs, sizeof(jobType));
+    if (jobs == NULL)
+    {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < numJobs; i++)
+    {
+        jobs[i].fileName = argv[optind + i];
+        length = strlen(jobs[i].fileName);
+        jobs[i].goldenName = malloc(length + sizeof(".golden"));
+        if (jobs[i].goldenName == NULL)
+        {
+            printf("error: out of memory\n");
+            exit(1);
+        }
+        strcpy(jobs[i].goldenName, jobs[i].fileName);
+        if (length > 3 && !strcmp(jobs[i].goldenName + length - 3, ".as"))
+        {
+            jobs[i].goldenName[length - 3] = '\0';
+        }
+        strcat(jobs[i].goldenName, ".golden");
+    }
+
+    for (i = 1; i < numThreads; i++)
+    {
+        pthread_create(&threads[i], NULL, worker, NULL);
+    }
+    worker(NULL);
+    for (i = 1; i < numThreads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (i = 0; i < numJobs; i++)
+    {
+        if (jobs[i].result == RESULT_OK)
+        {
+            printf("%s: ok, %d cycles\n", jobs[i].fileName, jobs[i].numHashes - 1);
+        }
+        else if (jobs[i].result == RESULT_RECORDED)
+        {
+            printf("%s: recorded %d cycles in %s\n", jobs[i].fileName, jobs[i].numHashes - 1,
+                   jobs[i].goldenName);
+        }
+        else if (jobs[i].result == RESULT_DIVERGED)
+        {
+            printf("%s: FAIL at cycle %d (golden %d cycles, now %d)\n", jobs[i].fileName,
+                   jobs[i].diverge, jobs[i].goldenHashes - 1, jobs[i].numHashes - 1);
+            printDivergence(&jobs[i]);
+            failed++;
+        }
+        else
+        {
+            printf("%s: %s\n", jobs[i].fileName, jobs[i].message);
+            failed++;
+        }
+    }
+    printf("%d programs, %d failed\n", numJobs, failed);
+    exit(failed ? 1 : 0);
+}
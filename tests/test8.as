@@ -0,0 +1,23 @@
+	lw	0	2	count	count down
+	lw	0	3	one
+	lw	0	6	neg1
+loop	lw	7	4	slots	each core bumps its own slot (reg 7 is the core number)
+	add	4	3	4
+	sw	7	4	slots	the slots share cache lines
+	lw	0	5	shared	and every core reads the shared word
+	add	2	6	2
+	beq	2	0	done
+	beq	0	0	loop
+done	halt
+count	.fill	20
+one	.fill	1
+neg1	.fill	-1
+shared	.fill	7
+slots	.fill	0
+	.fill	0
+	.fill	0
+	.fill	0
+	.fill	0
+	.fill	0
+	.fill	0
+	.fill	0
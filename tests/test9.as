@@ -0,0 +1,27 @@
+	lw	0	1	n1
+	lw	0	2	one
+	lw	0	3	neg1
+la	lw	0	4	one
+	add	4	5	5
+	add	1	3	1
+	beq	1	0	lb0
+	beq	0	0	la
+lb0	lw	0	1	n2
+lb	add	5	2	5
+	nand	5	5	6
+	add	6	7	7
+	add	1	3	1
+	beq	1	0	lc0
+	beq	1	1	lb
+lc0	lw	0	1	n3
+lc	add	1	3	1
+	sw	1	5	buf
+	beq	1	0	done
+	beq	0	0	lc
+done	halt
+n1	.fill	300
+n2	.fill	200
+n3	.fill	400
+one	.fill	1
+neg1	.fill	-1
+buf	.fill	0
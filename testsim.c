@@ -2,10 +2,15 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <math.h>
+#include "lc3101.h"
 
 #define NUMMEMORY 65536 /* maximum number of data words in memory */
 #define NUMREGS 8 /* number of machine registers */
 #define MAXLINELENGTH 1000
+#define MAXLABELLENGTH 7 /* includes the null character termination */
 
 #define ADD 0
 #define NAND 1
@@ -18,13 +23,27 @@
 
 #define NOOPINSTRUCTION 0x1c00000
 
+/* pipeline registers, in pipeline order */
+#define LATCH_IFID 0
+#define LATCH_IDEX 1
+#define LATCH_EXMEM 2
+#define LATCH_MEMWB 3
+#define LATCH_WBEND 4
+#define NUMLATCHES 5
+
+/*
+ * every latch carries the address its instruction was fetched from (pc),
+ * or -1 for a bubble inserted by a stall or squash
+ */
 typedef struct IFIDStruct {
     int instr;
+    int pc;
     int pcPlus1;
 } IFIDType;
 
 typedef struct IDEXStruct {
     int instr;
+    int pc;
     int pcPlus1;
     int readRegA;
     int readRegB;
@@ -33,6 +52,7 @@ typedef struct IDEXStruct {
 
 typedef struct EXMEMStruct {
     int instr;
+    int pc;
     int branchTarget;
     int aluResult;
     int readRegB;
@@ -40,18 +60,24 @@ typedef struct EXMEMStruct {
 
 typedef struct MEMWBStruct {
     int instr;
+    int pc;
     int writeData;
 } MEMWBType;
 
 typedef struct WBENDStruct {
     int instr;
+    int pc;
     int writeData;
 } WBENDType;
 
+/*
+ * the memories are NUMMEMORY-word arrays referenced, not copied, by every
+ * copy of the state; only the MEM stage writes dataMem
+ */
 typedef struct stateStruct {
     int pc;
-    int instrMem[NUMMEMORY];
-    int dataMem[NUMMEMORY];
+    int *instrMem;
+    int *dataMem;
     int reg[NUMREGS];
     int numMemory;
     IFIDType IFID;
@@ -60,12 +86,261 @@ typedef struct stateStruct {
     MEMWBType MEMWB;
     WBENDType WBEND;
     int cycles; /* number of cycles run so far */
+    int stalled; /* IDEX inserted a load-use bubble during this cycle */
+    int squashed; /* EXMEM squashed a taken branch during this cycle */
+    int storeOld; /* word overwritten by this cycle's sw */
 } stateType;
 
+/*
+ * debug map written by the assembler.  Everything is indexed by address so
+ * the trace never searches strings; symbol[] holds the index of the nearest
+ * label at or below each address (-1 if none).
+ */
+typedef struct debugMapStruct {
+    int loaded;
+    int numEntries;
+    int line[NUMMEMORY];
+    int symbol[NUMMEMORY];
+    char label[NUMMEMORY][MAXLABELLENGTH];
+    char *source[NUMMEMORY];
+} debugMapType;
+
+debugMapType debugMap;
+
+/*
+ * per-PC profile.  Each cycle is charged to the next instruction to
+ * retire (enter WBEND); stall cycles go to the instruction held in IFID
+ * and the three squashed slots of a taken beq go to the beq.
+ */
+typedef struct profileStruct {
+    long long retired[NUMMEMORY];
+    long long cycles[NUMMEMORY];
+    long long stalls[NUMMEMORY];
+    long long squashes[NUMMEMORY];
+    long long taken[NUMMEMORY];
+    int lastRetire; /* cycle of the most recent retirement */
+} profileType;
+
+profileType profile;
+int traceEnabled = 1;
+int profileEnabled = 0;
+
+/*
+ * debugger.  Breakpoints on retired PCs and stores/register writes are
+ * rejected through bitmaps, so the run loop does no string work; the
+ * breakpoint list (and any condition) is only consulted after a bitmap
+ * or cycle-count hit.
+ */
+#define MAXBREAKPOINTS 64
+
+#define BREAK_PC 0
+#define BREAK_CYCLE 1
+#define WATCH_MEM 2
+#define WATCH_REG 3
+
+#define OPERAND_CONST 0
+#define OPERAND_REG 1
+#define OPERAND_MEM 2
+#define OPERAND_PC 3
+#define OPERAND_CYCLES 4
+
+#define COND_EQ 0
+#define COND_NE 1
+#define COND_LT 2
+#define COND_LE 3
+#define COND_GT 4
+#define COND_GE 5
+
+#define DEBUG_RUN 0
+#define DEBUG_STEPCYCLE 1
+#define DEBUG_STEPINSTR 2
+
+#define BITTEST(map, i) ((map)[(i) >> 3] & (1 << ((i) & 7)))
+#define BITSET(map, i) ((map)[(i) >> 3] |= (1 << ((i) & 7)))
+
+typedef struct operandStruct {
+    int kind;
+    int value; /* constant, register number or memory address */
+} operandType;
+
+typedef struct conditionStruct {
+    int active;
+    int op;
+    operandType left;
+    operandType right;
+} conditionType;
+
+typedef struct breakpointStruct {
+    int kind;
+    int target; /* pc, cycle, memory address or register number */
+    conditionType cond;
+} breakpointType;
+
+typedef struct debuggerStruct {
+    unsigned char pcBreak[NUMMEMORY / 8];
+    unsigned char memWatch[NUMMEMORY / 8];
+    int regWatch; /* one bit per register */
+    int nextCycle; /* earliest pending cycle breakpoint, -1 if none */
+    int numBreakpoints;
+    breakpointType breakpoints[MAXBREAKPOINTS];
+    int mode;
+    int stepCount;
+} debuggerType;
+
+debuggerType debugger;
+int debugEnabled = 0;
+
+/*
+ * sampling trace.  The full state is printed only every period cycles or
+ * with probability rate; stalls, squashes, stores into [storeLo, storeHi]
+ * and halt are always reported.  The last ringSize cycles are kept as
+ * snapshots (everything but memory) for a post-mortem dump at halt or
+ * fault.
+ */
+typedef struct snapshotStruct {
+    int pc;
+    int cycles;
+    int reg[NUMREGS];
+    IFIDType IFID;
+    IDEXType IDEX;
+    EXMEMType EXMEM;
+    MEMWBType MEMWB;
+    WBENDType WBEND;
+} snapshotType;
+
+typedef struct samplerStruct {
+    int period; /* 0 for no periodic samples */
+    double rate; /* 0 for no random samples */
+    unsigned int seed;
+    int storeLo;
+    int storeHi; /* storeLo > storeHi for no store events */
+    int ringSize;
+    int ringNext;
+    int ringCount;
+    snapshotType *ring;
+} samplerType;
+
+#define SAMPLESEED 2463534242u
+
+samplerType sampler = { 0, 0.0, SAMPLESEED, 1, 0, 16, 0, 0, NULL };
+int sampleEnabled = 0;
+
+/*
+ * memory-access log: every load and store performed by the MEM stage is
+ * appended, buffered, to a binary file read by memanalyze.  The file
+ * format is in lc3101.h.
+ */
+#define MEMLOGBUFFER 4096
+
+typedef struct memLogStruct {
+    FILE *filePtr;
+    int count;
+    memRecordType buffer[MEMLOGBUFFER];
+} memLogType;
+
+memLogType memLog;
+int memLogEnabled = 0;
+
+/*
+ * multicore mode.  Every core is a full pipeline with its own pc, registers
+ * and latches over the shared instrMem and dataMem.  A cycle has two
+ * phases separated by barriers: all cores simulate their stages in
+ * parallel (loads read memory as it was at the start of the cycle), then
+ * one thread commits the stores and runs the L1 coherence model in core
+ * order, so results do not depend on host scheduling.  The L1s are
+ * direct-mapped MESI caches that track tags and states only; a miss or an
+ * upgrade freezes the core's pipeline for a fixed number of cycles.
+ */
+#define MAXCORES 16
+#define COREIDREG 7 /* register preset to the core number */
+#define L1LINES 16
+#define L1WORDS 4 /* words per line */
+#define L1MISSPENALTY 10
+#define L1UPGRADEPENALTY 2
+
+#define MESI_I 0
+#define MESI_S 1
+#define MESI_E 2
+#define MESI_M 3
+
+#define CORE_RUNNING 0
+#define CORE_HALTED 1
+#define CORE_FAULTED 2
+
+typedef struct l1Struct {
+    int tag[L1LINES]; /* line address (addr / L1WORDS) held in each set */
+    int mesi[L1LINES];
+    long long reads;
+    long long writes;
+    long long misses;
+    long long upgrades;
+    long long invalidations; /* lines taken away by other cores */
+    long long writebacks;
+} l1Type;
+
+typedef struct coreStruct {
+    int id;
+    int status;
+    int freeze; /* cycles left waiting on the L1 */
+    int frozen; /* the pipeline did not advance this cycle */
+    long long retired;
+    stateType state;
+    stateType newState;
+    l1Type l1;
+} coreType;
+
+typedef struct multicoreStruct {
+    int numThreads;
+    int done;
+    coreType cores[MAXCORES];
+    pthread_barrier_t barrier;
+    long long busRd;
+    long long busRdX;
+    long long busUpgr;
+    long long flushes; /* modified lines supplied or written back */
+} multicoreType;
+
+multicoreType multicore;
+int numCores = 1;
+
+/*
+ * sampled simulation (-S skip:warm:measure).  The run alternates between
+ * executing skip instructions functionally (pc, registers and memory only,
+ * no cycles) and running the pipeline in detail from an empty state for
+ * warm + measure instructions.  A window is timed from the warm-th
+ * retirement to the last, so the PIPELINEFILL cycles an empty pipeline
+ * takes to retire its first instruction are never counted; warm must be
+ * at least 1 for that.  Total cycles are estimated as the mean CPI of the windows times
+ * the exact instruction count, plus the cycles to fill the pipeline, with
+ * a 95% confidence interval from the spread of the windows' CPIs.
+ */
+#define PIPELINEFILL 3 /* cycles before the first instruction retires */
+
+#define STEP_RUNNING 0
+#define STEP_HALTED 1
+#define STEP_FAULT 2
+
+typedef struct sampledStruct {
+    int skip;
+    int warm;
+    int measure;
+    long long instructions; /* executed, functionally or in detail */
+    long long detailed; /* retired in the pipeline */
+    int windows; /* complete measurement windows */
+    double sumCPI;
+    double sumSquaredCPI;
+} sampledType;
+
+sampledType sampled;
+int sampledEnabled = 0;
+int validateEnabled = 0;
+
 
 void printState(stateType *);
+void printLatch(stateType *statePtr, int latch);
 int convertNum(int num);
 void clearRegisters(stateType *statePtr);
+void resetRunState(void);
 int getRegisters(int instruction, int * regA, int * regB);
 void ALU(stateType state,stateType * newState);
 void DataMemory(stateType  state, stateType * newState);
@@ -85,84 +360,382 @@ void checkMEMWB(stateType  state, stateType * newState,  int nRegA, int nRegB);
 void compareSet(int Lreg, int Rreg, int * sR, int iR);
 
 //default
-void run(stateType statePtr);
 void printInstruction(int instr);
+void printInstructionAt(int instr, int pc);
+void printSymbol(int address);
+void loadDebugMap(char *fileName);
+void profileCycle(stateType state, stateType * newState);
+void printProfile(stateType *statePtr);
+int debugTrigger(stateType state, stateType * newState);
+int debugMatch(int kind, int target, stateType *statePtr);
+void printBreakpoint(breakpointType *bp);
+void updateNextCycle(int cycles);
+void rebuildBreakpoints(int cycles);
+int parseAddress(char *string);
+int parseOperand(char *string, operandType *operand);
+int parseCondition(char *string, conditionType *cond);
+int operandValue(operandType *operand, stateType *statePtr);
+int evalCondition(conditionType *cond, stateType *statePtr);
+void addBreakpoint(int kind, int target, conditionType *cond, int cycles);
+void debugConsole(stateType *statePtr);
+void sampleState(stateType *statePtr);
+void sampleEvents(stateType state, stateType * newState);
+void dumpRing(void);
+int checkFault(stateType *statePtr);
+void coreCycle(coreType *core);
+int l1Access(coreType *core, int addr, int write);
+void commitCycle(void);
+void *coreThread(void *arg);
+int runMulticore(stateType state);
+hashType hashWord(hashType hash, int word);
+int stepFunctional(stateType *statePtr);
+int detailedWindow(stateType *statePtr, int *cycles);
+double tValue(int df);
+long long runSampled(stateType *machine);
+hashType hashState(stateType *statePtr, hashType hash);
+void openMemLog(char *fileName);
+void logMemAccess(stateType *statePtr);
+void closeMemLog(void);
 int field0(int instruction);
 int field1(int instruction);
 int field2(int instruction);
 int opcode(int instruction);
 
+#ifndef LC3101_LIBRARY
 int main(int argc, char *argv[])
 {
-    char line[MAXLINELENGTH];
-    stateType state;
+    imageType image;
+    stateType *machine;
     FILE *filePtr;
+    char *mapFile = NULL, *memLogFile = NULL;
+    long long estimate;
+    int quiet = 0, opt;
+
+    while ((opt = getopt(argc, argv, "c:dg:j:k:m:pqr:s:w:S:V")) != -1)
+    {
+        if (opt == 'g')
+        {
+            mapFile = optarg;
+        }
+        else if (opt == 'c')
+        {
+            numCores = atoi(optarg);
+            if (numCores < 1 || numCores > MAXCORES)
+            {
+                printf("error: -c expects 1 to %d cores\n", MAXCORES);
+                exit(1);
+            }
+            traceEnabled = 0;
+        }
+        else if (opt == 'j')
+        {
+            multicore.numThreads = atoi(optarg);
+        }
+        else if (opt == 'm')
+        {
+            memLogFile = optarg;
+        }
+        else if (opt == 'd')
+        {
+            debugEnabled = 1;
+            traceEnabled = 0;
+        }
+        else if (opt == 'p')
+        {
+            profileEnabled = 1;
+            traceEnabled = 0;
+        }
+        else if (opt == 'q')
+        {
+            quiet = 1;
+            traceEnabled = 0;
+        }
+        else if (opt == 'S')
+        {
+            if (sscanf(optarg, "%d:%d:%d", &sampled.skip, &sampled.warm, &sampled.measure) != 3 ||
+                sampled.skip < 0 || sampled.warm < 1 || sampled.measure < 1)
+            {
+                printf("error: -S expects <skip>:<warm>:<measure> instructions, warm at least 1\n");
+                exit(1);
+            }
+            sampledEnabled = 1;
+            traceEnabled = 0;
+        }
+        else if (opt == 'V')
+        {
+            validateEnabled = 1;
+        }
+        else if (opt == 's' || opt == 'r' || opt == 'k' || opt == 'w')
+        {
+            sampleEnabled = 1;
+            traceEnabled = 0;
+            if (opt == 's')
+            {
+                sampler.period = atoi(optarg);
+            }
+            else if (opt == 'r')
+            {
+                sampler.rate = atof(optarg);
+            }
+            else if (opt == 'k')
+            {
+                sampler.ringSize = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            }
+            else if (sscanf(optarg, "%d:%d", &sampler.storeLo, &sampler.storeHi) != 2)
+            {
+                printf("error: -w expects <low>:<high>\n");
+                exit(1);
+            }
+        }
+        else
+        {
+            optind = argc + 1;
+            break;
+        }
+    }
 
-    if (argc != 2)
+    if (argc - optind != 1)
     {
-        printf("error: usage: %s <machine-code file>\n", argv[0]);
+        printf("error: usage: %s [-g debug-map] [-m access-log] [-c cores [-j threads, default 1]] [-S skip:warm:measure [-V]] [-d] [-p] [-q] [-s period] [-r rate] [-w low:high] [-k cycles] <machine-code file>\n", argv[0]);
         exit(1);
     }
-    filePtr = fopen(argv[1], "r");
+    /* the multicore run has no trace, debugger, profile, sampler or log */
+    if (numCores > 1 && (debugEnabled || profileEnabled || quiet || sampleEnabled ||
+                         sampledEnabled || memLogFile != NULL))
+    {
+        printf("error: -c cannot be combined with -d, -p, -q, -s, -r, -w, -k, -S or -m\n");
+        exit(1);
+    }
+    /* a sampled run is timed in windows with no debugger, profile, sampler or log */
+    if (sampledEnabled && (debugEnabled || profileEnabled || sampleEnabled || memLogFile != NULL))
+    {
+        printf("error: -S cannot be combined with -d, -p, -s, -r, -w, -k or -m\n");
+        exit(1);
+    }
+    if (validateEnabled && !sampledEnabled)
+    {
+        printf("error: -V needs -S\n");
+        exit(1);
+    }
+    if (memLogFile != NULL)
+    {
+        openMemLog(memLogFile);
+    }
+    filePtr = fopen(argv[optind], "r");
     if (filePtr == NULL)
     {
-        printf("error: can't open file %s", argv[1]);
+        printf("error: can't open file %s", argv[optind]);
         perror("fopen");
         exit(1);
     }
 
-    clearRegisters(&state);
+    if (mapFile != NULL)
+    {
+        loadDebugMap(mapFile);
+    }
 
-    /* read in the entire machine-code file into memory */
-    for (state.numMemory = 0; fgets(line, MAXLINELENGTH, filePtr) != NULL; state.numMemory++)
+    if (readMachineCode(filePtr, &image) != LC_OK)
+    {
+        printf("%s\n", image.error);
+        exit(1);
+    }
+    if (load(&image, &machine) != LC_OK)
+    {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    if (traceEnabled)
     {
-        if (sscanf(line, "%d", state.dataMem + state.numMemory) != 1)
+        for (int i = 0; i < machine->numMemory; i++)
         {
-            printf("error in reading address %d\n", state.numMemory);
-            exit(1);
+            printf("memory[%d]=%d\n", i, machine->dataMem[i]);
         }
+    }
+    if (traceEnabled) {
+        printf("\t\tinstruction memory:\n");
+
+        for(int i = 0; i < machine->numMemory; i++ ) {
+            printf("\t\t\tinstrMem[%d]", i );
+            printInstructionAt(machine->instrMem[i], i);
+
+        }
+    }
 
-        printf("memory[%d]=%d\n", state.numMemory, state.dataMem[state.numMemory]);
 
-        if (sscanf(line, "%d", state.instrMem + state.numMemory) != 1)
+    if (numCores > 1) {
+        exit(runMulticore(*machine));
+    }
+    if (sampledEnabled) {
+        estimate = runSampled(machine);
+        if (!validateEnabled) {
+            exit(estimate < 0);
+        }
+        /* compare with a full detailed run of the same image */
+        unload(machine);
+        resetRunState();
+        if (load(&image, &machine) != LC_OK)
         {
-            printf("error in reading address %d\n", state.numMemory);
+            printf("error: out of memory\n");
+            exit(1);
+        }
+        if (run(machine) != LC_OK) {
             exit(1);
         }
+        if (estimate >= 0) {
+            printf("sampling error %+.2f%%\n", 100.0 * (estimate - machine->cycles) / machine->cycles);
+        }
+        exit(0);
+    }
+    exit(run(machine));
+}
+#endif
 
+//loading
+
+//read a machine-code file, one decimal word per line
+int readMachineCode(FILE *filePtr, imageType *image) {
+
+    char line[MAXLINELENGTH];
+
+    memset(image, 0, sizeof(imageType));
+    image->words = malloc(NUMMEMORY * sizeof(int));
+    if (image->words == NULL) {
+        snprintf(image->error, LC_MAXERROR, "error: out of memory");
+        return LC_ERROR;
+    }
+    for (image->numWords = 0; fgets(line, MAXLINELENGTH, filePtr) != NULL; image->numWords++) {
+        if (image->numWords == NUMMEMORY ||
+            sscanf(line, "%d", image->words + image->numWords) != 1) {
+            snprintf(image->error, LC_MAXERROR, "error in reading address %d", image->numWords);
+            free(image->words);
+            image->words = NULL;
+            return LC_ERROR;
+        }
     }
-    printf("\t\tinstruction memory:\n");
+    return LC_OK;
+}
+
+//build a machine with the image in both memories, ready for its first cycle
+int load(const imageType *image, machineType **machine) {
 
-    for(int i = 0; i < state.numMemory; i++ ) {
-        printf("\t\t\tinstrMem[%d]", i );
-        printInstruction(state.instrMem[i]);
+    stateType *state;
 
+    if (image->numWords > NUMMEMORY) {
+        return LC_ERROR;
+    }
+    state = calloc(1, sizeof(stateType));
+    if (state == NULL) {
+        return LC_ERROR;
+    }
+    state->instrMem = calloc(NUMMEMORY, sizeof(int));
+    state->dataMem = calloc(NUMMEMORY, sizeof(int));
+    if (state->instrMem == NULL || state->dataMem == NULL) {
+        unload(state);
+        return LC_ERROR;
     }
+    memcpy(state->instrMem, image->words, image->numWords * sizeof(int));
+    memcpy(state->dataMem, image->words, image->numWords * sizeof(int));
+    state->numMemory = image->numWords;
+    clearRegisters(state);
+    setInitialState(state);
+    *machine = state;
+    return LC_OK;
+}
 
+/*
+ * forget what an earlier run in this process left behind: profile counts,
+ * breakpoints, the trace ring and sampled-simulation totals.  Options are
+ * kept.  The profile is 2.5MB, so it is only cleared when profiling is on.
+ * These are process globals, so only main calls this; load() is used by
+ * several threads at once (regress -j).
+ */
+void resetRunState(void) {
+
+    if (profileEnabled) {
+        memset(&profile, 0, sizeof(profile));
+    }
+    memset(&debugger, 0, sizeof(debugger));
+    debugger.nextCycle = -1;
+    sampler.seed = SAMPLESEED;
+    sampler.ringNext = 0;
+    sampler.ringCount = 0;
+    sampled.instructions = 0;
+    sampled.detailed = 0;
+    sampled.windows = 0;
+    sampled.sumCPI = 0.0;
+    sampled.sumSquaredCPI = 0.0;
+}
 
-    run(state);
+void unload(machineType *machine) {
 
-    return (0);
+    free(machine->instrMem);
+    free(machine->dataMem);
+    free(machine);
 }
 
-void run(stateType state) {
 
-    stateType newState;
-    setInitialState(&state);
+//run the machine until it halts (LC_OK) or faults (LC_ERROR)
+int run(stateType *machine) {
+
+    stateType state = *machine, newState;
+
+    if (debugEnabled) {
+        debugger.nextCycle = -1;
+        debugConsole(&state);
+    }
+    if (sampleEnabled && sampler.ring == NULL) {
+        sampler.ring = malloc(sampler.ringSize * sizeof(snapshotType));
+        if (sampler.ring == NULL) {
+            printf("error: can't allocate %d trace cycles\n", sampler.ringSize);
+            return LC_ERROR;
+        }
+    }
 
     while (1) {
 
-        printState(&state);
+        if (traceEnabled) {
+            printState(&state);
+        }
+        if (sampleEnabled) {
+            sampleState(&state);
+        }
 
         /* check for halt */
         if (opcode(state.MEMWB.instr) == HALT) {
+            if (sampleEnabled) {
+                printf("event cycle %d halt\n", state.cycles);
+                dumpRing();
+            }
             printf("machine halted\n");
             printf("total of %d cycles executed\n", state.cycles);
-            exit(0);
+            if (profileEnabled) {
+                printProfile(&state);
+            }
+            if (memLogEnabled) {
+                closeMemLog();
+            }
+            *machine = state;
+            return LC_OK;
+        }
+
+        if (checkFault(&state)) {
+            if (sampleEnabled) {
+                dumpRing();
+            }
+            if (memLogEnabled) {
+                closeMemLog();
+            }
+            *machine = state;
+            return LC_ERROR;
+        }
+        if (memLogEnabled) {
+            logMemAccess(&state);
         }
 
         newState = state;
         newState.cycles++;
+        newState.stalled = 0;
+        newState.squashed = 0;
 
         /* --------------------- IF stage --------------------- */
 
@@ -182,6 +755,16 @@ void run(stateType state) {
 
         WBEND(state,&newState);
 
+        if (profileEnabled) {
+            profileCycle(state, &newState);
+        }
+        if (sampleEnabled) {
+            sampleEvents(state, &newState);
+        }
+        if (debugEnabled && debugTrigger(state, &newState)) {
+            debugConsole(&newState);
+        }
+
         state = newState; /* this is the last statement before end of the loop.
                     It marks the end of the cycle and updates the
                     current state with the values calculated in this
@@ -189,6 +772,284 @@ void run(stateType state) {
     }
 }
 
+//state hashes
+
+/*
+ * Golden traces keep one 64-bit hash per cycle instead of the printState
+ * text.  Each hash folds the previous one with pc, the registers, every
+ * latch field and the word stored during the cycle before, so a run can be
+ * checked against a golden one cycle by cycle and the first cycle whose
+ * hash differs is the first whose state differs.  Hashing starts from the
+ * loaded image, which covers the rest of memory.
+ */
+#define HASHSEED 0xcbf29ce484222325ULL
+#define HASHPRIME 0x100000001b3ULL
+
+hashType hashWord(hashType hash, int word) {
+    return (hash ^ (unsigned int) word) * HASHPRIME;
+}
+
+hashType hashState(stateType *statePtr, hashType hash) {
+    int i;
+
+    hash = hashWord(hash, statePtr->pc);
+    for (i = 0; i < NUMREGS; i++) {
+        hash = hashWord(hash, statePtr->reg[i]);
+    }
+    hash = hashWord(hash, statePtr->IFID.instr);
+    hash = hashWord(hash, statePtr->IFID.pc);
+    hash = hashWord(hash, statePtr->IFID.pcPlus1);
+    hash = hashWord(hash, statePtr->IDEX.instr);
+    hash = hashWord(hash, statePtr->IDEX.pc);
+    hash = hashWord(hash, statePtr->IDEX.pcPlus1);
+    hash = hashWord(hash, statePtr->IDEX.readRegA);
+    hash = hashWord(hash, statePtr->IDEX.readRegB);
+    hash = hashWord(hash, statePtr->IDEX.offset);
+    hash = hashWord(hash, statePtr->EXMEM.instr);
+    hash = hashWord(hash, statePtr->EXMEM.pc);
+    hash = hashWord(hash, statePtr->EXMEM.branchTarget);
+    hash = hashWord(hash, statePtr->EXMEM.aluResult);
+    hash = hashWord(hash, statePtr->EXMEM.readRegB);
+    hash = hashWord(hash, statePtr->MEMWB.instr);
+    hash = hashWord(hash, statePtr->MEMWB.pc);
+    hash = hashWord(hash, statePtr->MEMWB.writeData);
+    hash = hashWord(hash, statePtr->WBEND.instr);
+    hash = hashWord(hash, statePtr->WBEND.pc);
+    hash = hashWord(hash, statePtr->WBEND.writeData);
+    return hash;
+}
+
+//run a freshly loaded machine quietly, recording hashes[c] for the state
+//before each cycle c; stops with LC_LIMIT before cycle limit
+int runHashed(stateType *machine, hashType *hashes, int limit, int *numHashes) {
+
+    stateType state = *machine, newState;
+    hashType hash = HASHSEED;
+    int i, addr;
+
+    *numHashes = 0;
+    for (i = 0; i < state.numMemory; i++) {
+        hash = hashWord(hash, state.instrMem[i]);
+    }
+
+    while (state.cycles < limit) {
+
+        hash = hashState(&state, hash);
+        hashes[state.cycles] = hash;
+        *numHashes = state.cycles + 1;
+
+        if (opcode(state.MEMWB.instr) == HALT) {
+            *machine = state;
+            return LC_OK;
+        }
+        if (checkFault(&state)) {
+            *machine = state;
+            return LC_ERROR;
+        }
+
+        newState = state;
+        newState.cycles++;
+        newState.stalled = 0;
+        newState.squashed = 0;
+
+        IFID(state, &newState);
+        IDEX(state, &newState);
+        EXMEM(state, &newState);
+        MEMWB(state, &newState);
+        WBEND(state, &newState);
+
+        if (opcode(state.EXMEM.instr) == SW) {
+            addr = state.EXMEM.aluResult;
+            hash = hashWord(hashWord(hash, addr), newState.dataMem[addr]);
+        }
+        state = newState;
+    }
+    *machine = state;
+    return LC_LIMIT;
+}
+
+//sampled simulation
+
+//execute the instruction at pc without the pipeline
+int stepFunctional(stateType *statePtr) {
+
+    int instr, code, regA, regB, addr;
+
+    if (statePtr->pc < 0 || statePtr->pc >= NUMMEMORY) {
+        printf("machine fault: fetch from %d\n", statePtr->pc);
+        return STEP_FAULT;
+    }
+    instr = statePtr->instrMem[statePtr->pc];
+    code = opcode(instr);
+    regA = statePtr->reg[field0(instr)];
+    regB = statePtr->reg[field1(instr)];
+
+    if (code == ADD) {
+        statePtr->reg[field2(instr)] = regA + regB;
+    } else if (code == NAND) {
+        statePtr->reg[field2(instr)] = ~(regA & regB);
+    } else if (code == LW || code == SW) {
+        addr = regA + convertNum(field2(instr));
+        if (addr < 0 || addr >= NUMMEMORY) {
+            printf("machine fault: %s of address %d by ",
+                   code == LW ? "load" : "store", addr);
+            printInstructionAt(instr, statePtr->pc);
+            return STEP_FAULT;
+        }
+        if (code == LW) {
+            statePtr->reg[field1(instr)] = statePtr->dataMem[addr];
+        } else {
+            statePtr->dataMem[addr] = regB;
+        }
+    } else if (code == BEQ && regA == regB) {
+        statePtr->pc += convertNum(field2(instr));
+    } else if (code == HALT) {
+        return STEP_HALTED;
+    }
+    statePtr->pc++;
+    return STEP_RUNNING;
+}
+
+/*
+ * run the pipeline from empty at pc until warm + measure instructions have
+ * retired, then leave pc at the oldest instruction still in flight.  Sets
+ * *cycles to the cycles the last measure instructions took, or -1 if the
+ * program stopped first.
+ */
+int detailedWindow(stateType *statePtr, int *cycles) {
+
+    stateType state = *statePtr, newState;
+    int retired = 0, start = state.cycles, status = STEP_RUNNING;
+
+    setInitialState(&state);
+    *cycles = -1;
+    while (retired < sampled.warm + sampled.measure) {
+        if (opcode(state.MEMWB.instr) == HALT) {
+            retired++;
+            status = STEP_HALTED;
+            break;
+        }
+        if (checkFault(&state)) {
+            status = STEP_FAULT;
+            break;
+        }
+
+        newState = state;
+        newState.cycles++;
+        newState.stalled = 0;
+        newState.squashed = 0;
+
+        IFID(state, &newState);
+        IDEX(state, &newState);
+        EXMEM(state, &newState);
+        MEMWB(state, &newState);
+        WBEND(state, &newState);
+
+        if (newState.WBEND.pc >= 0 && ++retired == sampled.warm) {
+            start = newState.cycles;
+        }
+        state = newState;
+    }
+    sampled.detailed += retired;
+    sampled.instructions += retired;
+    if (status == STEP_RUNNING) {
+        *cycles = state.cycles - start;
+    }
+
+    /* registers hold exactly the retired instructions; a sw in MEMWB has
+       stored already, but storing again from the same registers is harmless */
+    if (state.MEMWB.pc >= 0) {
+        state.pc = state.MEMWB.pc;
+    } else if (state.EXMEM.pc >= 0) {
+        state.pc = state.EXMEM.pc;
+    } else if (state.IDEX.pc >= 0) {
+        state.pc = state.IDEX.pc;
+    } else if (state.IFID.pc >= 0) {
+        state.pc = state.IFID.pc;
+    }
+    *statePtr = state;
+    return status;
+}
+
+//two-sided 95% t value for df degrees of freedom
+double tValue(int df) {
+    static double small[] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447,
+                              2.365, 2.306, 2.262, 2.228, 2.201, 2.179,
+                              2.160, 2.145, 2.131, 2.120, 2.110, 2.101,
+                              2.093, 2.086, 2.080, 2.074, 2.069, 2.064,
+                              2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+
+    if (df <= 30) {
+        return small[df - 1];
+    }
+    if (df <= 40) {
+        return 2.021;
+    }
+    if (df <= 60) {
+        return 2.000;
+    }
+    return df <= 120 ? 1.980 : 1.960;
+}
+
+//run skip/warm/measure periods to the end and report the estimated cycles;
+//returns the estimate, or -1 if no window completed
+long long runSampled(stateType *machine) {
+
+    stateType state = *machine;
+    int status = STEP_RUNNING, cycles, i;
+    double cpi, mean, halfWidth = 0.0;
+    long long estimate;
+
+    while (status == STEP_RUNNING) {
+        for (i = 0; i < sampled.skip && status == STEP_RUNNING; i++) {
+            status = stepFunctional(&state);
+            sampled.instructions++;
+        }
+        if (status != STEP_RUNNING) {
+            break;
+        }
+        status = detailedWindow(&state, &cycles);
+        if (cycles >= 0) {
+            cpi = (double) cycles / sampled.measure;
+            sampled.windows++;
+            sampled.sumCPI += cpi;
+            sampled.sumSquaredCPI += cpi * cpi;
+        }
+    }
+    *machine = state;
+
+    printf("machine %s after %lld instructions, %lld (%.1f%%) in detail\n",
+           status == STEP_HALTED ? "halted" : "faulted", sampled.instructions,
+           sampled.detailed, 100.0 * sampled.detailed / sampled.instructions);
+    if (sampled.windows == 0) {
+        printf("no measurement window completed; try a shorter -S period\n");
+        return -1;
+    }
+
+    mean = sampled.sumCPI / sampled.windows;
+    if (sampled.windows > 1) {
+        halfWidth = (sampled.sumSquaredCPI - sampled.windows * mean * mean) /
+                    (sampled.windows - 1);
+        halfWidth = tValue(sampled.windows - 1) *
+                    sqrt(halfWidth > 0.0 ? halfWidth : 0.0) / sqrt(sampled.windows);
+    }
+    estimate = (long long) (mean * sampled.instructions + 0.5) + PIPELINEFILL;
+    printf("%d windows of %d instructions (%d warm-up, %d skipped between)\n",
+           sampled.windows, sampled.measure, sampled.warm, sampled.skip);
+    printf("CPI %.4f", mean);
+    if (sampled.windows > 1) {
+        printf(" +- %.4f", halfWidth);
+    }
+    printf("\nestimated total of %lld cycles", estimate);
+    if (sampled.windows > 1) {
+        printf(", 95%% interval %.0f .. %.0f",
+               (mean - halfWidth) * sampled.instructions + PIPELINEFILL,
+               (mean + halfWidth) * sampled.instructions + PIPELINEFILL);
+    }
+    printf("\n");
+    return estimate;
+}
+
 //alu use to do the calculation
 void ALU(stateType state, stateType * newState) {
 
@@ -226,8 +1087,10 @@ void DataMemory(stateType state, stateType * newState) {
     {
         (*newState).MEMWB.writeData = state.dataMem[state.EXMEM.aluResult];
 
-    } else if(SW == code) {
+    } else if(SW == code && numCores == 1) {
 
+        /* with several cores commitCycle stores, in core order */
+        (*newState).storeOld = state.dataMem[state.EXMEM.aluResult];
         (*newState).dataMem[state.EXMEM.aluResult] = (*newState).EXMEM.readRegB;
 
     } else if(ADD == code || NAND == code) {
@@ -263,6 +1126,7 @@ void WriteBack(stateType  state, stateType * newState ) {
 void IFID(stateType  state, stateType * newState) {
 
     (*newState).IFID.pcPlus1 = state.pc + 1;
+    (*newState).IFID.pc = state.pc;
     (*newState).IFID.instr =  state.instrMem[ state.pc];
 
     (*newState).pc=state.pc + 1;
@@ -273,6 +1137,7 @@ void IDEX(stateType  state, stateType * newState) {
 
     (*newState).IDEX.pcPlus1 = state.IFID.pcPlus1;
     (*newState).IDEX.instr =   state.IFID.instr;
+    (*newState).IDEX.pc = state.IFID.pc;
 
     int regAOff, regBOff;
 
@@ -285,9 +1150,11 @@ void IDEX(stateType  state, stateType * newState) {
     (*newState).IDEX.offset = offset;
 
     if(stallHazard(state, newState) == 1) {
+        (*newState).stalled = 1;
         (*newState).IFID = state.IFID;
         (*newState).pc = state.pc;
         (*newState).IDEX.instr = NOOPINSTRUCTION;
+        (*newState).IDEX.pc = -1;
     }
 
 }
@@ -296,20 +1163,27 @@ void IDEX(stateType  state, stateType * newState) {
 void EXMEM(stateType  state, stateType * newState) {
 
     (*newState).EXMEM.instr =   state.IDEX.instr;
+    (*newState).EXMEM.pc = state.IDEX.pc;
 
     (*newState).EXMEM.branchTarget =   state.IDEX.pcPlus1 +  state.IDEX.offset;
     forwardHazard(state,newState);
 
-    printInstruction((*newState).EXMEM.instr);
+    if (traceEnabled) {
+        printInstructionAt((*newState).EXMEM.instr, (*newState).EXMEM.pc);
+    }
 
     (*newState).EXMEM.readRegB =  state.IDEX.readRegB;
     ALU(state,newState);
 
     if(specSquashHazard(state, newState) == 1) {
+        (*newState).squashed = 1;
         (*newState).pc =   (*newState).EXMEM.branchTarget - 1;
         (*newState).IFID.instr = NOOPINSTRUCTION;
         (*newState).IDEX.instr = NOOPINSTRUCTION;
         (*newState).EXMEM.instr = NOOPINSTRUCTION;
+        (*newState).IFID.pc = -1;
+        (*newState).IDEX.pc = -1;
+        (*newState).EXMEM.pc = -1;
     }
 }
 
@@ -317,6 +1191,7 @@ void EXMEM(stateType  state, stateType * newState) {
 void MEMWB(stateType  state, stateType * newState) {
 
     (*newState).MEMWB.instr =  state.EXMEM.instr;
+    (*newState).MEMWB.pc = state.EXMEM.pc;
     DataMemory(state,newState);
 }
 
@@ -324,6 +1199,7 @@ void MEMWB(stateType  state, stateType * newState) {
 void WBEND(stateType  state, stateType * newState) {
 
     (*newState).WBEND.instr =  state.MEMWB.instr;
+    (*newState).WBEND.pc = state.MEMWB.pc;
     (*newState).WBEND.writeData =  state.MEMWB.writeData;
     WriteBack(state, newState);
 }
@@ -450,6 +1326,866 @@ void checkEXMEM(stateType  state, stateType * newState,  int nRegA, int nRegB )
     }
 }
 
+//profiler
+
+//charge the cycle just simulated to the instructions responsible for it
+void profileCycle(stateType state, stateType * newState) {
+
+    int pc = (*newState).WBEND.pc;
+
+    if (pc >= 0) {
+        profile.retired[pc]++;
+        profile.cycles[pc] += (*newState).cycles - profile.lastRetire;
+        profile.lastRetire = (*newState).cycles;
+    }
+    if ((*newState).stalled && state.IFID.pc >= 0) {
+        profile.stalls[state.IFID.pc]++;
+    }
+    if ((*newState).squashed && state.EXMEM.pc >= 0) {
+        profile.taken[state.EXMEM.pc]++;
+        profile.squashes[state.EXMEM.pc] += 3;
+    }
+}
+
+int profileCompare(const void *a, const void *b) {
+
+    long long ca = profile.cycles[*(const int *) a];
+    long long cb = profile.cycles[*(const int *) b];
+
+    if (ca != cb) {
+        return (ca < cb) ? 1 : -1;
+    }
+    return *(const int *) a - *(const int *) b;
+}
+
+//print the flat per-PC profile and one line per backward-branch loop
+void printProfile(stateType *statePtr) {
+
+    static int order[NUMMEMORY];
+    static long long prefix[NUMMEMORY + 1];
+    int i, n, pc, target;
+    long long total, loopCycles, loopStalls, loopSquashes;
+
+    /* the halt never reaches WBEND; charge the remaining cycles to it */
+    pc = (*statePtr).MEMWB.pc;
+    if (pc >= 0) {
+        profile.retired[pc]++;
+        profile.cycles[pc] += (*statePtr).cycles - profile.lastRetire;
+        profile.lastRetire = (*statePtr).cycles;
+    }
+
+    total = (*statePtr).cycles > 0 ? (*statePtr).cycles : 1;
+
+    printf("\nflat profile:\n");
+    printf("%8s %10s %10s %6s %8s %8s %6s  %s\n", "pc", "retired",
+           "cycles", "cpi", "stalls", "squash", "%", "instruction");
+    for (i = 0, n = 0; i < (*statePtr).numMemory; i++) {
+        if (profile.retired[i] > 0) {
+            order[n++] = i;
+        }
+    }
+    qsort(order, n, sizeof(int), profileCompare);
+    for (i = 0; i < n; i++) {
+        pc = order[i];
+        printf("%8d %10lld %10lld %6.2f %8lld %8lld %6.2f  ", pc,
+               profile.retired[pc], profile.cycles[pc],
+               (double) profile.cycles[pc] / profile.retired[pc],
+               profile.stalls[pc], profile.squashes[pc],
+               100.0 * profile.cycles[pc] / total);
+        printInstructionAt((*statePtr).instrMem[pc], pc);
+    }
+
+    /* a loop is the range from a backward beq's target up to the beq */
+    prefix[0] = 0;
+    for (i = 0; i < (*statePtr).numMemory; i++) {
+        prefix[i + 1] = prefix[i] + profile.cycles[i];
+    }
+
+    printf("\nloop profile:\n");
+    printf("%8s %8s %10s %10s %8s %8s %6s\n", "head", "backedge",
+           "iterations", "cycles", "stalls", "squash", "%");
+    for (pc = 0; pc < (*statePtr).numMemory; pc++) {
+        if (opcode((*statePtr).instrMem[pc]) != BEQ ||
+            profile.retired[pc] == 0) {
+            continue;
+        }
+        target = pc + 1 + convertNum(field2((*statePtr).instrMem[pc]));
+        if (target > pc || target < 0) {
+            continue;
+        }
+        loopStalls = loopSquashes = 0;
+        for (i = target; i <= pc; i++) {
+            loopStalls += profile.stalls[i];
+            loopSquashes += profile.squashes[i];
+        }
+        loopCycles = prefix[pc + 1] - prefix[target];
+        printf("%8d %8d %10lld %10lld %8lld %8lld %6.2f  ", target, pc,
+               profile.taken[pc] + 1, loopCycles, loopStalls, loopSquashes,
+               100.0 * loopCycles / total);
+        printSymbol(target);
+        printf(" .. ");
+        printSymbol(pc);
+        printf("\n");
+    }
+}
+
+//debugger
+
+//check the cycle just simulated against steps, breakpoints and watchpoints
+int debugTrigger(stateType state, stateType * newState) {
+
+    int hit = 0;
+    int pc = (*newState).WBEND.pc;
+    int code, addr, dest;
+
+    if (debugger.mode == DEBUG_STEPCYCLE && --debugger.stepCount <= 0) {
+        hit = 1;
+    }
+    if (debugger.mode == DEBUG_STEPINSTR && pc >= 0 &&
+        --debugger.stepCount <= 0) {
+        hit = 1;
+    }
+
+    if (pc >= 0 && BITTEST(debugger.pcBreak, pc)) {
+        hit |= debugMatch(BREAK_PC, pc, newState);
+    }
+    if (debugger.nextCycle >= 0 && (*newState).cycles >= debugger.nextCycle) {
+        hit |= debugMatch(BREAK_CYCLE, debugger.nextCycle, newState);
+        updateNextCycle((*newState).cycles);
+    }
+
+    /* the store performed by the MEM stage this cycle */
+    code = opcode(state.EXMEM.instr);
+    addr = state.EXMEM.aluResult;
+    if (code == SW && addr >= 0 && addr < NUMMEMORY &&
+        BITTEST(debugger.memWatch, addr) &&
+        debugMatch(WATCH_MEM, addr, newState)) {
+        printf("\tmem[%d] %d -> %d\n", addr, (*newState).storeOld,
+               (*newState).dataMem[addr]);
+        hit = 1;
+    }
+
+    /* the register written by the WB stage this cycle */
+    code = opcode((*newState).WBEND.instr);
+    if (code == LW || code == ADD || code == NAND) {
+        dest = (code == LW) ? field1((*newState).WBEND.instr)
+                            : field2((*newState).WBEND.instr);
+        if (dest < NUMREGS && (debugger.regWatch & (1 << dest)) &&
+            debugMatch(WATCH_REG, dest, newState)) {
+            printf("\treg[%d] %d -> %d\n", dest, state.reg[dest],
+                   (*newState).reg[dest]);
+            hit = 1;
+        }
+    }
+
+    return hit;
+}
+
+//report every breakpoint on kind/target whose condition holds
+int debugMatch(int kind, int target, stateType *statePtr) {
+
+    int i, hit = 0;
+    breakpointType *bp;
+
+    for (i = 0; i < debugger.numBreakpoints; i++) {
+        bp = &debugger.breakpoints[i];
+        if (bp->kind != kind || bp->target != target) {
+            continue;
+        }
+        if (bp->cond.active && !evalCondition(&bp->cond, statePtr)) {
+            continue;
+        }
+        printf("breakpoint %d: ", i);
+        printBreakpoint(bp);
+        hit = 1;
+    }
+    return hit;
+}
+
+void printBreakpoint(breakpointType *bp) {
+
+    if (bp->kind == BREAK_PC) {
+        printf("break ");
+        printSymbol(bp->target);
+    } else if (bp->kind == BREAK_CYCLE) {
+        printf("break cycle %d", bp->target);
+    } else if (bp->kind == WATCH_MEM) {
+        printf("watch mem ");
+        printSymbol(bp->target);
+    } else {
+        printf("watch reg %d", bp->target);
+    }
+    if (bp->cond.active) {
+        printf(" (conditional)");
+    }
+    printf("\n");
+}
+
+//earliest cycle breakpoint after cycles, or -1
+void updateNextCycle(int cycles) {
+
+    int i;
+
+    debugger.nextCycle = -1;
+    for (i = 0; i < debugger.numBreakpoints; i++) {
+        if (debugger.breakpoints[i].kind == BREAK_CYCLE &&
+            debugger.breakpoints[i].target > cycles &&
+            (debugger.nextCycle < 0 ||
+             debugger.breakpoints[i].target < debugger.nextCycle)) {
+            debugger.nextCycle = debugger.breakpoints[i].target;
+        }
+    }
+}
+
+//rebuild the bitmaps from the breakpoint list
+void rebuildBreakpoints(int cycles) {
+
+    int i;
+    breakpointType *bp;
+
+    memset(debugger.pcBreak, 0, sizeof(debugger.pcBreak));
+    memset(debugger.memWatch, 0, sizeof(debugger.memWatch));
+    debugger.regWatch = 0;
+    for (i = 0; i < debugger.numBreakpoints; i++) {
+        bp = &debugger.breakpoints[i];
+        if (bp->kind == BREAK_PC) {
+            BITSET(debugger.pcBreak, bp->target);
+        } else if (bp->kind == WATCH_MEM) {
+            BITSET(debugger.memWatch, bp->target);
+        } else if (bp->kind == WATCH_REG) {
+            debugger.regWatch |= 1 << bp->target;
+        }
+    }
+    updateNextCycle(cycles);
+}
+
+//an address is a number or a label from the debug map
+int parseAddress(char *string) {
+
+    int i, num;
+    char c;
+
+    if (sscanf(string, "%d%c", &num, &c) == 1) {
+        return (num >= 0 && num < NUMMEMORY) ? num : -1;
+    }
+    for (i = 0; i < debugMap.numEntries; i++) {
+        if (!strcmp(debugMap.label[i], string)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//operand: number, pc, cycles, reg[n] (or rn) or mem[address]
+int parseOperand(char *string, operandType *operand) {
+
+    char inner[MAXLINELENGTH], c;
+    int end = -1;
+
+    /* %n is only stored once the closing ] has matched; end must then be
+       the end of the string, so reg[3x, mem[5) and reg[3]x are all refused */
+    if (!strcmp(string, "pc")) {
+        operand->kind = OPERAND_PC;
+    } else if (!strcmp(string, "cycles")) {
+        operand->kind = OPERAND_CYCLES;
+    } else if ((sscanf(string, "reg[%d]%n", &operand->value, &end) == 1 &&
+                end >= 0 && string[end] == '\0') ||
+               sscanf(string, "r%d%c", &operand->value, &c) == 1) {
+        operand->kind = OPERAND_REG;
+        return operand->value >= 0 && operand->value < NUMREGS;
+    } else if (sscanf(string, "mem[%[^]]]%n", inner, &end) == 1 &&
+               end >= 0 && string[end] == '\0') {
+        operand->kind = OPERAND_MEM;
+        operand->value = parseAddress(inner);
+        return operand->value >= 0;
+    } else if (sscanf(string, "%d%c", &operand->value, &c) == 1) {
+        operand->kind = OPERAND_CONST;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+//condition: <operand> <op> <operand>
+int parseCondition(char *string, conditionType *cond) {
+
+    static const char *ops[] = { "==", "!=", "<", "<=", ">", ">=" };
+    char left[MAXLINELENGTH], op[MAXLINELENGTH], right[MAXLINELENGTH];
+    int i;
+
+    if (sscanf(string, "%s %s %s", left, op, right) != 3 ||
+        !parseOperand(left, &cond->left) ||
+        !parseOperand(right, &cond->right)) {
+        return 0;
+    }
+    for (i = 0; i < 6 && strcmp(op, ops[i]); i++) {
+    }
+    cond->op = i;
+    cond->active = 1;
+    return i < 6;
+}
+
+int operandValue(operandType *operand, stateType *statePtr) {
+
+    if (operand->kind == OPERAND_REG) {
+        return statePtr->reg[operand->value];
+    } else if (operand->kind == OPERAND_MEM) {
+        return statePtr->dataMem[operand->value];
+    } else if (operand->kind == OPERAND_PC) {
+        return statePtr->pc;
+    } else if (operand->kind == OPERAND_CYCLES) {
+        return statePtr->cycles;
+    }
+    return operand->value;
+}
+
+int evalCondition(conditionType *cond, stateType *statePtr) {
+
+    int l = operandValue(&cond->left, statePtr);
+    int r = operandValue(&cond->right, statePtr);
+
+    if (cond->op == COND_EQ) {
+        return l == r;
+    } else if (cond->op == COND_NE) {
+        return l != r;
+    } else if (cond->op == COND_LT) {
+        return l < r;
+    } else if (cond->op == COND_LE) {
+        return l <= r;
+    } else if (cond->op == COND_GT) {
+        return l > r;
+    }
+    return l >= r;
+}
+
+void addBreakpoint(int kind, int target, conditionType *cond, int cycles) {
+
+    breakpointType *bp;
+
+    if (debugger.numBreakpoints >= MAXBREAKPOINTS) {
+        printf("error: too many breakpoints\n");
+        return;
+    }
+    bp = &debugger.breakpoints[debugger.numBreakpoints];
+    bp->kind = kind;
+    bp->target = target;
+    bp->cond = *cond;
+    printf("breakpoint %d: ", debugger.numBreakpoints++);
+    printBreakpoint(bp);
+    rebuildBreakpoints(cycles);
+}
+
+//interactive console; returns when execution should resume
+void debugConsole(stateType *statePtr) {
+
+    static const char *latchNames[] = { "IFID", "IDEX", "EXMEM", "MEMWB",
+                                        "WBEND" };
+    char line[MAXLINELENGTH], cmd[MAXLINELENGTH], arg0[MAXLINELENGTH],
+        arg1[MAXLINELENGTH], *ifPtr, c;
+    conditionType cond;
+    operandType operand;
+    int n, i, num;
+
+    printf("stopped before cycle %d, pc %d, last retired ",
+           statePtr->cycles, statePtr->pc);
+    printInstructionAt(statePtr->WBEND.instr, statePtr->WBEND.pc);
+
+    while (1) {
+        printf("(lc3101) ");
+        fflush(stdout);
+        if (fgets(line, MAXLINELENGTH, stdin) == NULL) {
+            /* no more commands: run to completion */
+            printf("\n");
+            debugEnabled = 0;
+            return;
+        }
+
+        cond.active = 0;
+        if ((ifPtr = strstr(line, " if ")) != NULL) {
+            *ifPtr = '\0';
+            if (!parseCondition(ifPtr + 4, &cond)) {
+                printf("error: bad condition\n");
+                continue;
+            }
+        }
+        cmd[0] = arg0[0] = arg1[0] = '\0';
+        n = sscanf(line, "%s %s %s", cmd, arg0, arg1);
+        if (n < 1) {
+            continue;
+        }
+
+        if (!strcmp(cmd, "break") || !strcmp(cmd, "b")) {
+            if (!strcmp(arg0, "cycle") && n == 3 &&
+                sscanf(arg1, "%d%c", &num, &c) == 1) {
+                addBreakpoint(BREAK_CYCLE, num, &cond, statePtr->cycles);
+            } else if (n == 2 && (num = parseAddress(arg0)) >= 0) {
+                addBreakpoint(BREAK_PC, num, &cond, statePtr->cycles);
+            } else {
+                printf("error: usage: break <address|label> | break cycle <n>\n");
+            }
+        } else if (!strcmp(cmd, "watch") || !strcmp(cmd, "w")) {
+            if (!strcmp(arg0, "mem") && n == 3 &&
+                (num = parseAddress(arg1)) >= 0) {
+                addBreakpoint(WATCH_MEM, num, &cond, statePtr->cycles);
+            } else if (!strcmp(arg0, "reg") && n == 3 &&
+                       sscanf(arg1, "%d%c", &num, &c) == 1 &&
+                       num >= 0 && num < NUMREGS) {
+                addBreakpoint(WATCH_REG, num, &cond, statePtr->cycles);
+            } else {
+                printf("error: usage: watch mem <address|label> | watch reg <n>\n");
+            }
+        } else if (!strcmp(cmd, "delete") || !strcmp(cmd, "d")) {
+            if (n == 1) {
+                debugger.numBreakpoints = 0;
+            } else if ((num = atoi(arg0)) >= 0 &&
+                       num < debugger.numBreakpoints) {
+                for (i = num; i + 1 < debugger.numBreakpoints; i++) {
+                    debugger.breakpoints[i] = debugger.breakpoints[i + 1];
+                }
+                debugger.numBreakpoints--;
+            }
+            rebuildBreakpoints(statePtr->cycles);
+        } else if (!strcmp(cmd, "info") || !strcmp(cmd, "i")) {
+            for (i = 0; i < debugger.numBreakpoints; i++) {
+                printf("%d: ", i);
+                printBreakpoint(&debugger.breakpoints[i]);
+            }
+        } else if (!strcmp(cmd, "step") || !strcmp(cmd, "s")) {
+            debugger.mode = DEBUG_STEPCYCLE;
+            debugger.stepCount = (n > 1) ? atoi(arg0) : 1;
+            return;
+        } else if (!strcmp(cmd, "stepi") || !strcmp(cmd, "si")) {
+            debugger.mode = DEBUG_STEPINSTR;
+            debugger.stepCount = (n > 1) ? atoi(arg0) : 1;
+            return;
+        } else if (!strcmp(cmd, "continue") || !strcmp(cmd, "c")) {
+            debugger.mode = DEBUG_RUN;
+            return;
+        } else if (!strcmp(cmd, "print") || !strcmp(cmd, "p")) {
+            for (i = 0; i < NUMLATCHES && strcmp(arg0, latchNames[i]); i++) {
+            }
+            if (i < NUMLATCHES) {
+                printLatch(statePtr, i);
+            } else if (!strcmp(arg0, "state")) {
+                printState(statePtr);
+            } else if (!strcmp(arg0, "reg")) {
+                for (i = 0; i < NUMREGS; i++) {
+                    printf("\treg[ %d ] %d\n", i, statePtr->reg[i]);
+                }
+            } else if (!strcmp(arg0, "mem") && n == 3 &&
+                       (num = parseAddress(arg1)) >= 0) {
+                printf("\tmem[%d] %d\n", num, statePtr->dataMem[num]);
+            } else if (n == 2 && parseOperand(arg0, &operand)) {
+                printf("\t%s %d\n", arg0, operandValue(&operand, statePtr));
+            } else {
+                printf("error: usage: print state|reg|mem <address>|IFID|IDEX|EXMEM|MEMWB|WBEND|<operand>\n");
+            }
+        } else if (!strcmp(cmd, "quit") || !strcmp(cmd, "q")) {
+            if (memLogEnabled) {
+                closeMemLog();
+            }
+            exit(0);
+        } else {
+            printf("commands:\n"
+                   "\tbreak <address|label> [if <cond>]\n"
+                   "\tbreak cycle <n> [if <cond>]\n"
+                   "\twatch mem <address|label> [if <cond>]\n"
+                   "\twatch reg <n> [if <cond>]\n"
+                   "\tdelete [n], info\n"
+                   "\tstep [n] (cycles), stepi [n] (retired instructions)\n"
+                   "\tcontinue, quit\n"
+                   "\tprint state|reg|mem <address>|<latch>|<operand>\n"
+                   "\t<cond> is <operand> <op> <operand>, op one of\n"
+                   "\t== != < <= > >=, operand a number, pc, cycles,\n"
+                   "\treg[n] or mem[address]\n");
+        }
+    }
+}
+
+//sampling trace
+
+//record the state about to be simulated and print it if it is sampled
+void sampleState(stateType *statePtr) {
+
+    snapshotType *snap = &sampler.ring[sampler.ringNext];
+    int sampled = 0;
+
+    snap->pc = statePtr->pc;
+    snap->cycles = statePtr->cycles;
+    memcpy(snap->reg, statePtr->reg, sizeof(snap->reg));
+    snap->IFID = statePtr->IFID;
+    snap->IDEX = statePtr->IDEX;
+    snap->EXMEM = statePtr->EXMEM;
+    snap->MEMWB = statePtr->MEMWB;
+    snap->WBEND = statePtr->WBEND;
+    sampler.ringNext = (sampler.ringNext + 1) % sampler.ringSize;
+    if (sampler.ringCount < sampler.ringSize) {
+        sampler.ringCount++;
+    }
+
+    if (sampler.period > 0 && statePtr->cycles % sampler.period == 0) {
+        sampled = 1;
+    }
+    if (sampler.rate > 0.0) {
+        /* xorshift32, so runs are reproducible */
+        sampler.seed ^= sampler.seed << 13;
+        sampler.seed ^= sampler.seed >> 17;
+        sampler.seed ^= sampler.seed << 5;
+        if (sampler.seed / 4294967296.0 < sampler.rate) {
+            sampled = 1;
+        }
+    }
+    if (sampled) {
+        printState(statePtr);
+    }
+}
+
+//report the events of the cycle just simulated
+void sampleEvents(stateType state, stateType * newState) {
+
+    int addr;
+
+    if ((*newState).stalled) {
+        printf("event cycle %d stall ", state.cycles);
+        printInstructionAt(state.IFID.instr, state.IFID.pc);
+    }
+    if ((*newState).squashed) {
+        printf("event cycle %d squash ", state.cycles);
+        printInstructionAt(state.EXMEM.instr, state.EXMEM.pc);
+    }
+    addr = state.EXMEM.aluResult;
+    if (opcode(state.EXMEM.instr) == SW && addr >= sampler.storeLo &&
+        addr <= sampler.storeHi) {
+        printf("event cycle %d store mem[%d] %d -> %d ", state.cycles, addr,
+               (*newState).storeOld, (*newState).dataMem[addr]);
+        printInstructionAt(state.EXMEM.instr, state.EXMEM.pc);
+    }
+}
+
+//print the buffered cycles, oldest first, in the printState format
+void dumpRing(void) {
+
+    static stateType view;
+    snapshotType *snap;
+    int i;
+
+    printf("\nlast %d cycles:\n", sampler.ringCount);
+    for (i = 0; i < sampler.ringCount; i++) {
+        snap = &sampler.ring[(sampler.ringNext - sampler.ringCount + i +
+                              sampler.ringSize) % sampler.ringSize];
+        view.pc = snap->pc;
+        view.cycles = snap->cycles;
+        memcpy(view.reg, snap->reg, sizeof(view.reg));
+        view.IFID = snap->IFID;
+        view.IDEX = snap->IDEX;
+        view.EXMEM = snap->EXMEM;
+        view.MEMWB = snap->MEMWB;
+        view.WBEND = snap->WBEND;
+        view.numMemory = 0; /* memory is not kept in the ring */
+        printState(&view);
+    }
+}
+
+//memory-access log
+
+void openMemLog(char *fileName) {
+
+    memLogHeaderType header;
+
+    memLog.filePtr = fopen(fileName, "wb");
+    if (memLog.filePtr == NULL) {
+        printf("error in opening %s\n", fileName);
+        exit(1);
+    }
+    header.magic = MEMLOGMAGIC;
+    header.recordSize = sizeof(memRecordType);
+    fwrite(&header, sizeof(header), 1, memLog.filePtr);
+    memLog.count = 0;
+    memLogEnabled = 1;
+}
+
+//log the access the MEM stage performs this cycle, if any
+void logMemAccess(stateType *statePtr) {
+
+    int code = opcode(statePtr->EXMEM.instr);
+    memRecordType *rec;
+
+    if (code != LW && code != SW) {
+        return;
+    }
+    rec = &memLog.buffer[memLog.count];
+    rec->cycleRw = ((unsigned int) statePtr->cycles << 1) | (code == SW);
+    rec->pc = statePtr->EXMEM.pc;
+    rec->addr = statePtr->EXMEM.aluResult;
+    if (++memLog.count == MEMLOGBUFFER) {
+        fwrite(memLog.buffer, sizeof(memRecordType), memLog.count,
+               memLog.filePtr);
+        memLog.count = 0;
+    }
+}
+
+void closeMemLog(void) {
+
+    fwrite(memLog.buffer, sizeof(memRecordType), memLog.count,
+           memLog.filePtr);
+    fclose(memLog.filePtr);
+    memLogEnabled = 0;
+}
+
+//multicore
+
+//phase one: simulate one cycle of a core's stages, without storing
+void coreCycle(coreType *core) {
+
+    stateType *state = &core->state;
+    stateType *newState = &core->newState;
+
+    *newState = *state;
+    newState->cycles++;
+    newState->stalled = 0;
+    newState->squashed = 0;
+
+    core->frozen = core->freeze > 0;
+    if (core->frozen) {
+        core->freeze--;
+        return;
+    }
+
+    IFID(*state, newState);
+    IDEX(*state, newState);
+    EXMEM(*state, newState);
+    MEMWB(*state, newState);
+    WBEND(*state, newState);
+}
+
+//look up addr in core's L1 and keep the other L1s coherent; returns the
+//cycles the core waits
+int l1Access(coreType *core, int addr, int write) {
+
+    l1Type *l1 = &core->l1, *other;
+    int line = addr / L1WORDS;
+    int set = line % L1LINES;
+    int hit = l1->mesi[set] != MESI_I && l1->tag[set] == line;
+    int shared = 0, i;
+
+    if (write) {
+        l1->writes++;
+    } else {
+        l1->reads++;
+    }
+    if (hit && (!write || l1->mesi[set] != MESI_S)) {
+        if (write) {
+            l1->mesi[set] = MESI_M; /* E -> M is silent */
+        }
+        return 0;
+    }
+
+    /* snoop: everyone else holding the line */
+    for (i = 0; i < numCores; i++) {
+        other = &multicore.cores[i].l1;
+        if (i == core->id || other->mesi[set] == MESI_I ||
+            other->tag[set] != line) {
+            continue;
+        }
+        if (other->mesi[set] == MESI_M) {
+            multicore.flushes++;
+            other->writebacks++;
+        }
+        if (write) {
+            other->mesi[set] = MESI_I;
+            other->invalidations++;
+        } else {
+            other->mesi[set] = MESI_S;
+            shared = 1;
+        }
+    }
+
+    if (hit) {
+        /* write to a shared line */
+        multicore.busUpgr++;
+        l1->upgrades++;
+        l1->mesi[set] = MESI_M;
+        return L1UPGRADEPENALTY;
+    }
+
+    if (l1->mesi[set] == MESI_M) {
+        multicore.flushes++;
+        l1->writebacks++;
+    }
+    if (write) {
+        multicore.busRdX++;
+    } else {
+        multicore.busRd++;
+    }
+    l1->misses++;
+    l1->tag[set] = line;
+    l1->mesi[set] = write ? MESI_M : (shared ? MESI_S : MESI_E);
+    return L1MISSPENALTY;
+}
+
+//phase two: commit stores and coherence in core order, then decide which
+//cores simulate the next cycle
+void commitCycle(void) {
+
+    coreType *core;
+    int i, code, addr, running = 0;
+
+    for (i = 0; i < numCores; i++) {
+        core = &multicore.cores[i];
+        if (core->status != CORE_RUNNING) {
+            continue;
+        }
+        if (!core->frozen) {
+            code = opcode(core->state.EXMEM.instr);
+            addr = core->state.EXMEM.aluResult;
+            if (code == LW) {
+                core->freeze += l1Access(core, addr, 0);
+            } else if (code == SW) {
+                core->freeze += l1Access(core, addr, 1);
+                core->newState.dataMem[addr] = core->newState.EXMEM.readRegB;
+            }
+            if (core->newState.WBEND.pc >= 0) {
+                core->retired++;
+            }
+        }
+        core->state = core->newState;
+    }
+
+    for (i = 0; i < numCores; i++) {
+        core = &multicore.cores[i];
+        if (core->status != CORE_RUNNING) {
+            continue;
+        }
+        if (opcode(core->state.MEMWB.instr) == HALT) {
+            core->status = CORE_HALTED;
+            core->retired++;
+            printf("core %d halted after %d cycles\n", i, core->state.cycles);
+        } else {
+            if (checkFault(&core->state)) {
+                printf("\tin core %d\n", i);
+                core->status = CORE_FAULTED;
+            } else {
+                running = 1;
+            }
+        }
+    }
+    multicore.done = !running;
+}
+
+//each host thread simulates the cores whose number is its own modulo the
+//number of threads
+void *coreThread(void *arg) {
+
+    long thread = (long) arg;
+    int i;
+
+    while (1) {
+        for (i = thread; i < numCores; i += multicore.numThreads) {
+            if (multicore.cores[i].status == CORE_RUNNING) {
+                coreCycle(&multicore.cores[i]);
+            }
+        }
+        pthread_barrier_wait(&multicore.barrier);
+        if (thread == 0) {
+            commitCycle();
+        }
+        pthread_barrier_wait(&multicore.barrier);
+        if (multicore.done) {
+            return NULL;
+        }
+    }
+}
+
+//run copies of the machine as cores; LC_ERROR if any of them faults
+int runMulticore(stateType state) {
+
+    pthread_t threads[MAXCORES];
+    coreType *core;
+    l1Type *l1;
+    long t;
+    int i, r, status = LC_OK;
+
+    /*
+     * threads meet at two barriers every simulated cycle for a few
+     * instructions of work each, so one thread is the default; -j only
+     * helps where it has been measured to
+     */
+    if (multicore.numThreads < 1) {
+        multicore.numThreads = 1;
+    }
+    if (multicore.numThreads > numCores) {
+        multicore.numThreads = numCores;
+    }
+    for (i = 0; i < numCores; i++) {
+        core = &multicore.cores[i];
+        core->id = i;
+        core->state = state;
+        core->state.reg[COREIDREG] = i;
+    }
+
+    pthread_barrier_init(&multicore.barrier, NULL, multicore.numThreads);
+    for (t = 1; t < multicore.numThreads; t++) {
+        pthread_create(&threads[t], NULL, coreThread, (void *) t);
+    }
+    coreThread((void *) 0);
+    for (t = 1; t < multicore.numThreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    printf("\n%5s %10s %10s %6s %8s %8s %8s %8s %8s %8s\n", "core", "cycles",
+           "retired", "cpi", "reads", "writes", "misses", "upgrades",
+           "invals", "wbacks");
+    for (i = 0; i < numCores; i++) {
+        core = &multicore.cores[i];
+        l1 = &core->l1;
+        printf("%5d %10d %10lld %6.2f %8lld %8lld %8lld %8lld %8lld %8lld\n",
+               i, core->state.cycles, core->retired,
+               core->retired ? (double) core->state.cycles / core->retired : 0.0,
+               l1->reads, l1->writes, l1->misses, l1->upgrades,
+               l1->invalidations, l1->writebacks);
+    }
+    printf("bus: %lld BusRd, %lld BusRdX, %lld BusUpgr, %lld flushes\n",
+           multicore.busRd, multicore.busRdX, multicore.busUpgr,
+           multicore.flushes);
+
+    printf("\tdata memory:\n");
+    for (i = 0; i < state.numMemory; i++) {
+        printf("\t\tdataMem[ %d ] %d\n", i, state.dataMem[i]);
+    }
+    for (i = 0; i < numCores; i++) {
+        printf("\tcore %d registers:\n", i);
+        for (r = 0; r < NUMREGS; r++) {
+            printf("\t\treg[ %d ] %d\n", r, multicore.cores[i].state.reg[r]);
+        }
+        if (multicore.cores[i].status == CORE_FAULTED) {
+            status = LC_ERROR;
+        }
+    }
+    return status;
+}
+
+//fault checks
+
+//report an access outside the machine's memory about to happen this cycle
+int checkFault(stateType *statePtr) {
+
+    int code = opcode(statePtr->EXMEM.instr);
+    int addr = statePtr->EXMEM.aluResult;
+
+    if (statePtr->pc < 0 || statePtr->pc >= NUMMEMORY) {
+        printf("machine fault: fetch from %d at cycle %d\n", statePtr->pc,
+               statePtr->cycles);
+        return 1;
+    }
+    if ((code == LW || code == SW) && (addr < 0 || addr >= NUMMEMORY)) {
+        printf("machine fault: %s of address %d at cycle %d by ",
+               code == LW ? "load" : "store", addr, statePtr->cycles);
+        printInstructionAt(statePtr->EXMEM.instr, statePtr->EXMEM.pc);
+        return 1;
+    }
+    return 0;
+}
+
 //utilities
 
 //clear registers
@@ -500,6 +2236,11 @@ void setInitialState(stateType *state) {
     (*state).EXMEM.instr  = NOOPINSTRUCTION;
     (*state).MEMWB.instr  = NOOPINSTRUCTION;
     (*state).WBEND.instr  = NOOPINSTRUCTION;
+    (*state).IFID.pc = -1;
+    (*state).IDEX.pc = -1;
+    (*state).EXMEM.pc = -1;
+    (*state).MEMWB.pc = -1;
+    (*state).WBEND.pc = -1;
 }
 
 //default method
@@ -516,31 +2257,44 @@ void printState(stateType *statePtr) {
     for (i=0; i<NUMREGS; i++) {
         printf("\t\treg[ %d ] %d\n", i, statePtr->reg[i]);
     }
-    printf("\tIFID:\n");
-    printf("\t\tinstruction ");
-    printInstruction(statePtr->IFID.instr);
-    printf("\t\tpcPlus1 %d\n", statePtr->IFID.pcPlus1);
-    printf("\tIDEX:\n");
-    printf("\t\tinstruction ");
-    printInstruction(statePtr->IDEX.instr);
-    printf("\t\tpcPlus1 %d\n", statePtr->IDEX.pcPlus1);
-    printf("\t\treadRegA %d\n", statePtr->IDEX.readRegA);
-    printf("\t\treadRegB %d\n", statePtr->IDEX.readRegB);
-    printf("\t\toffset %d\n", statePtr->IDEX.offset);
-    printf("\tEXMEM:\n");
-    printf("\t\tinstruction ");
-    printInstruction(statePtr->EXMEM.instr);
-    printf("\t\tbranchTarget %d\n", statePtr->EXMEM.branchTarget);
-    printf("\t\taluResult %d\n", statePtr->EXMEM.aluResult);
-    printf("\t\treadRegB %d\n", statePtr->EXMEM.readRegB);
-    printf("\tMEMWB:\n");
-    printf("\t\tinstruction ");
-    printInstruction(statePtr->MEMWB.instr);
-    printf("\t\twriteData %d\n", statePtr->MEMWB.writeData);
-    printf("\tWBEND:\n");
-    printf("\t\tinstruction ");
-    printInstruction(statePtr->WBEND.instr);
-    printf("\t\twriteData %d\n", statePtr->WBEND.writeData);
+    for (i=0; i<NUMLATCHES; i++) {
+        printLatch(statePtr, i);
+    }
+}
+
+//print one pipeline register in the printState format
+void printLatch(stateType *statePtr, int latch) {
+    if (latch == LATCH_IFID) {
+        printf("\tIFID:\n");
+        printf("\t\tinstruction ");
+        printInstructionAt(statePtr->IFID.instr, statePtr->IFID.pc);
+        printf("\t\tpcPlus1 %d\n", statePtr->IFID.pcPlus1);
+    } else if (latch == LATCH_IDEX) {
+        printf("\tIDEX:\n");
+        printf("\t\tinstruction ");
+        printInstructionAt(statePtr->IDEX.instr, statePtr->IDEX.pc);
+        printf("\t\tpcPlus1 %d\n", statePtr->IDEX.pcPlus1);
+        printf("\t\treadRegA %d\n", statePtr->IDEX.readRegA);
+        printf("\t\treadRegB %d\n", statePtr->IDEX.readRegB);
+        printf("\t\toffset %d\n", statePtr->IDEX.offset);
+    } else if (latch == LATCH_EXMEM) {
+        printf("\tEXMEM:\n");
+        printf("\t\tinstruction ");
+        printInstructionAt(statePtr->EXMEM.instr, statePtr->EXMEM.pc);
+        printf("\t\tbranchTarget %d\n", statePtr->EXMEM.branchTarget);
+        printf("\t\taluResult %d\n", statePtr->EXMEM.aluResult);
+        printf("\t\treadRegB %d\n", statePtr->EXMEM.readRegB);
+    } else if (latch == LATCH_MEMWB) {
+        printf("\tMEMWB:\n");
+        printf("\t\tinstruction ");
+        printInstructionAt(statePtr->MEMWB.instr, statePtr->MEMWB.pc);
+        printf("\t\twriteData %d\n", statePtr->MEMWB.writeData);
+    } else if (latch == LATCH_WBEND) {
+        printf("\tWBEND:\n");
+        printf("\t\tinstruction ");
+        printInstructionAt(statePtr->WBEND.instr, statePtr->WBEND.pc);
+        printf("\t\twriteData %d\n", statePtr->WBEND.writeData);
+    }
 }
 
 int field0(int instruction) {
@@ -560,6 +2314,14 @@ int opcode(int instruction) {
 }
 
 void printInstruction(int instr) {
+    printInstructionAt(instr, -1);
+}
+
+/*
+ * print an instruction; when a debug map is loaded and the address is
+ * known, follow it with its symbol, source line and any branch target
+ */
+void printInstructionAt(int instr, int pc) {
     char opcodeString[10];
     if (opcode(instr) == ADD) {
         strcpy(opcodeString, "add");
@@ -581,6 +2343,76 @@ void printInstruction(int instr) {
         strcpy(opcodeString, "data");
     }
 
-    printf("%s %d %d %d\n", opcodeString, field0(instr), field1(instr),
+    printf("%s %d %d %d", opcodeString, field0(instr), field1(instr),
            field2(instr));
+
+    if (debugMap.loaded && pc >= 0 && pc < debugMap.numEntries) {
+        printf("\t; ");
+        printSymbol(pc);
+        printf(" line %d: %s", debugMap.line[pc], debugMap.source[pc]);
+        if (opcode(instr) == BEQ) {
+            printf(" -> ");
+            printSymbol(pc + 1 + convertNum(field2(instr)));
+        }
+    }
+    printf("\n");
+}
+
+//print an address as label+offset using the debug map
+void printSymbol(int address) {
+    int sym = -1;
+
+    if (address >= 0 && address < debugMap.numEntries) {
+        sym = debugMap.symbol[address];
+    }
+    if (sym < 0) {
+        printf("%d", address);
+    } else if (sym == address) {
+        printf("%s", debugMap.label[sym]);
+    } else {
+        printf("%s+%d", debugMap.label[sym], address - sym);
+    }
+}
+
+//read the debug map written by the assembler and build the symbol index
+void loadDebugMap(char *fileName) {
+    char line[MAXLINELENGTH], label[MAXLINELENGTH], source[MAXLINELENGTH];
+    int address, lineNum, i, sym;
+    FILE *filePtr = fopen(fileName, "r");
+
+    if (filePtr == NULL) {
+        printf("error: can't open debug map %s\n", fileName);
+        exit(1);
+    }
+
+    debugMap.numEntries = 0;
+    while (fgets(line, MAXLINELENGTH, filePtr) != NULL) {
+        if (line[0] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%d %d %s %[^\n]", &address, &lineNum, label,
+                   source) != 4 || address < 0 || address >= NUMMEMORY ||
+            strlen(label) >= MAXLABELLENGTH) {
+            printf("error in debug map line: %s", line);
+            exit(1);
+        }
+        debugMap.line[address] = lineNum;
+        strcpy(debugMap.label[address], strcmp(label, "-") ? label : "");
+        debugMap.source[address] = strdup(source);
+        if (address >= debugMap.numEntries) {
+            debugMap.numEntries = address + 1;
+        }
+    }
+    fclose(filePtr);
+
+    for (i = 0, sym = -1; i < debugMap.numEntries; i++) {
+        if (debugMap.source[i] == NULL) {
+            debugMap.source[i] = "";
+        }
+        if (debugMap.label[i][0] != '\0') {
+            sym = i;
+        }
+        debugMap.symbol[i] = sym;
+    }
+    debugMap.loaded = 1;
 }
\ No newline at end of file